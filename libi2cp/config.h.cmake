@@ -0,0 +1,7 @@
+#cmakedefine WITH_GNUTLS
+#cmakedefine HAVE_SYS_EPOLL_H
+#cmakedefine HAVE_SYS_EVENTFD_H
+#cmakedefine HAVE_GETADDRINFO_A
+#cmakedefine WITH_IO_URING
+#cmakedefine WITH_LIBDEFLATE
+#cmakedefine WITH_ZLIB_NG
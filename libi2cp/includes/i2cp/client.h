@@ -19,10 +19,19 @@
 #ifndef _client_h
 #define _client_h
 
+#include <stdlib.h>
+#include <inttypes.h>
 #include "logger.h"
 
 struct i2cp_session_t;
 struct i2cp_client_t;
+struct stream_t;
+
+/** \brief Handler of received i2cp messages of a type.
+    \param[in] body Stream of the message body, only valid during the call.
+    \see i2cp_client_register_handler
+ */
+typedef void (*i2cp_client_message_handler_t)(struct i2cp_client_t *client, struct stream_t *body, void *opaque);
 
 /** \brief i2cp client context properties */
 typedef enum i2cp_client_property_t
@@ -32,14 +41,101 @@ typedef enum i2cp_client_property_t
   CLIENT_PROP_ROUTER_USE_TLS,
   CLIENT_PROP_USERNAME,
   CLIENT_PROP_PASSWORD,
+  /** Max bytes of queued messages gathered into one write per i2cp_client_process_io(),
+      0 or unset sends everything queued. A smaller batch returns sooner to reading
+      the socket, a larger one sends more per syscall and TLS record sequence. */
+  CLIENT_PROP_SEND_BATCH_BYTES,
+  /** Output queue size in bytes above which on_backpressure is dispatched, 0 or unset
+      disables it. */
+  CLIENT_PROP_SEND_HIGH_WATER,
+  /** Set to "1" to use the io_uring transport for the router connection, only
+      available when built with ENABLE_IO_URING. */
+  CLIENT_PROP_ROUTER_USE_IO_URING,
+  /** Path of the router unix domain socket, used instead of router address and
+      port when set. Also read from i2cp.unix.path in ~/.i2cp.conf */
+  CLIENT_PROP_ROUTER_UNIX_PATH,
+  /** PEM file of CAs trusted for the router TLS certificate. When set, a router
+      certificate not signed by one of them is rejected. When unset the system CA
+      bundle is used and an untrusted certificate, like the self signed one of a
+      stock router, is accepted with a warning.
+      Also read from i2cp.tcp.SSL.caFile in ~/.i2cp.conf */
+  CLIENT_PROP_ROUTER_TLS_CA_FILE,
+  /** PEM file of the router TLS certificate, when set the router must present exactly
+      this certificate. Also read from i2cp.tcp.SSL.pinnedCertificate in ~/.i2cp.conf */
+  CLIENT_PROP_ROUTER_TLS_PINNED_CERTIFICATE,
+  /** Set to "1" to dispatch payloads sent with stored gzip blocks as a read only view
+      into the receive buffer instead of a copy. The payload stream passed to on_message
+      must then not be written to. */
+  CLIENT_PROP_RECV_ZERO_COPY,
+  /** Max bytes per second sent to the router, "router" follows the outbound limits
+      of the BandwidthLimits reported by router. 0 or unset disables shaping. */
+  CLIENT_PROP_SEND_RATE,
   NR_OF_I2CP_CLIENT_PROPERTIES
 } i2cp_client_property_t;
 
+/** \brief i2cp client connection states */
+typedef enum i2cp_client_state_t
+{
+  I2CP_CLIENT_STATE_DISCONNECTED,
+  I2CP_CLIENT_STATE_RESOLVING,
+  I2CP_CLIENT_STATE_CONNECTING,
+  I2CP_CLIENT_STATE_TLS_HANDSHAKE,
+  I2CP_CLIENT_STATE_AWAIT_SETDATE,
+  I2CP_CLIENT_STATE_READY
+} i2cp_client_state_t;
+
+/** \brief Thread running payload dispatch of a client with an io thread.
+    \see i2cp_client_start_io_thread
+ */
+typedef enum i2cp_client_dispatch_t
+{
+  /** on_message is dispatched on the io thread */
+  CLIENT_DISPATCH_IO_THREAD,
+  /** Payloads are handed to a consumer thread calling i2cp_client_dispatch() */
+  CLIENT_DISPATCH_CONSUMER
+} i2cp_client_dispatch_t;
+
+/** \brief Bandwidth limits reported by router, in KBytes per second */
+typedef struct i2cp_bandwidth_limits_t
+{
+  uint32_t client_inbound;
+  uint32_t client_outbound;
+  uint32_t router_inbound;
+  uint32_t router_inbound_burst;
+  uint32_t router_outbound;
+  uint32_t router_outbound_burst;
+  /** \brief Seconds the burst limits may be used */
+  uint32_t router_burst_time;
+} i2cp_bandwidth_limits_t;
+
 typedef struct i2cp_client_callbacks_t
 {
   void *opaque;
   void (*on_disconnect)(struct i2cp_client_t *client, const char *reason, void *opaque);
   void (*on_log)(struct i2cp_client_t *client, i2cp_logger_tags_t tags, const char *message, void *opaque);
+
+  /** \brief Output queue crossed the high water mark.
+      Dispatched with above set when more than CLIENT_PROP_SEND_HIGH_WATER bytes are
+      queued, producers should stop sending until dispatched again with above cleared
+      which happens when the queue has drained to half the high water mark.
+      \param[in] queued Bytes currently in output queue.
+   */
+  void (*on_backpressure)(struct i2cp_client_t *client, size_t queued, int above, void *opaque);
+
+  /** \brief The i2cp handshake with router is completed and sessions can be created. */
+  void (*on_connected)(struct i2cp_client_t *client, void *opaque);
+
+  /** \brief Router sent a status for a session of the client.
+      Also dispatched with a status other than I2CP_SESSION_STATUS_CREATED when the
+      router rejected a session created with i2cp_client_create_session_async().
+      \param[in] status The i2cp_session_status_t of session.
+   */
+  void (*on_session_status)(struct i2cp_client_t *client, struct i2cp_session_t *session, int status, void *opaque);
+
+  /** \brief Router sent its bandwidth limits.
+      Requested when the client is connected and by i2cp_client_request_bandwidth_limits().
+   */
+  void (*on_bandwidth_limits)(struct i2cp_client_t *client, const i2cp_bandwidth_limits_t *limits, void *opaque);
 } i2cp_client_callbacks_t;
 
 typedef enum i2cp_protocol_t
@@ -80,9 +176,32 @@ void i2cp_client_set_property(struct i2cp_client_t *self, i2cp_client_property_t
  */
 const char * i2cp_client_get_property(struct i2cp_client_t *self, i2cp_client_property_t property);
 
-/** \brief Establishes i2cp connection of the i2cp client context.*/
+/** \brief Register a handler for received i2cp messages of a type.
+    Replaces the built-in handler of the type, which allows applications to
+    intercept messages or handle message types unknown to the client.
+    \param[in] type I2CP message type.
+    \param[in] handler The handler or NULL to restore the built-in handler.
+    \param[in] opaque Passed to the handler.
+ */
+void i2cp_client_register_handler(struct i2cp_client_t *self, uint8_t type,
+				  i2cp_client_message_handler_t handler, void *opaque);
+
+/** \brief Establishes i2cp connection of the i2cp client context.
+    Blocks until the i2cp handshake is completed or the connect failed.
+ */
 void i2cp_client_connect(struct i2cp_client_t *self);
 
+/** \brief Starts establishing the i2cp connection without blocking.
+    The hostname lookup, connect, TLS and i2cp handshakes are advanced by
+    i2cp_client_process_io() or i2cp_client_run(). on_connected is dispatched
+    when the client is ready and on_disconnect if the connect failed.
+    \see i2cp_client_get_state
+ */
+void i2cp_client_connect_async(struct i2cp_client_t *self);
+
+/** \brief Get the connection state of the i2cp client context. */
+i2cp_client_state_t i2cp_client_get_state(struct i2cp_client_t *self);
+
 /** \brief Disconnects the i2cp connection of the i2cp client context.*/
 void i2cp_client_disconnect(struct i2cp_client_t *self);
 
@@ -95,10 +214,113 @@ int i2cp_client_is_connected(struct i2cp_client_t *self);
  */
 void i2cp_client_create_session(struct i2cp_client_t *self, struct i2cp_session_t *session);
 
+/** \brief Creates specified session without waiting for the router response.
+ *  May be called while the client is connecting, the CreateSession is sent
+ *  when the client is ready. The router response is dispatched to the session
+ *  on_status and client on_session_status callbacks.
+ *  \return 0 on success or -1 if the session could not be created.
+ */
+int i2cp_client_create_session_async(struct i2cp_client_t *self, struct i2cp_session_t *session);
+
 /** \brief Process i2cp io
+    Must not be called from more than one thread at a time, messages sent by
+    other threads are written by the next call.
  */
 int i2cp_client_process_io(struct i2cp_client_t *self);
 
+/** \brief Get the socket descriptor of the router connection.
+    Used for embedding the client into an application event loop, call
+    i2cp_client_process_io() when the descriptor is readable or when it is
+    writable and i2cp_client_wants_write() is non zero.
+    \return The descriptor or -1 if not connected.
+ */
+int i2cp_client_get_fd(struct i2cp_client_t *self);
+
+/** \brief Check if the client has queued data to write.
+    Zero while CLIENT_PROP_SEND_RATE holds back queued data, or while the
+    io_uring send ring is full in which case the descriptor turns readable
+    when sends complete.
+    \return non zero if the client wants to be polled for writability.
+ */
+int i2cp_client_wants_write(struct i2cp_client_t *self);
+
+/** \brief Get time until CLIENT_PROP_SEND_RATE allows sending queued data.
+    Applications polling i2cp_client_get_fd() should call i2cp_client_process_io()
+    after this time.
+    \return Milliseconds to wait, 0 if not held back.
+ */
+int i2cp_client_send_delay(struct i2cp_client_t *self);
+
+/** \brief Request bandwidth limits from router.
+    \see i2cp_client_callbacks_t::on_bandwidth_limits
+ */
+void i2cp_client_request_bandwidth_limits(struct i2cp_client_t *self);
+
+/** \brief Get the bandwidth limits last reported by router.
+    \return 0 on success, -1 if router hasn't reported limits.
+ */
+int i2cp_client_get_bandwidth_limits(struct i2cp_client_t *self, i2cp_bandwidth_limits_t *limits);
+
+/** \brief Wait for and process i2cp io.
+    Blocks until the router connection is readable, writable while there is
+    data queued, or the timeout expires and then processes io.
+    \param[in] timeout Max time to wait in milliseconds, -1 waits forever.
+    \return Same as i2cp_client_process_io() or < 0 if not connected.
+ */
+int i2cp_client_run(struct i2cp_client_t *self, int timeout);
+
+/** \brief Start an io thread which runs i2cp_client_run() until the client is
+    disconnected or i2cp_client_stop_io_thread() is called.
+    The io thread owns the router connection, the application must not call
+    i2cp_client_process_io(), i2cp_client_run() or change sessions while it is
+    running. Messages sent from any thread wake it up to be written.
+
+    With CLIENT_DISPATCH_CONSUMER payloads are handed to the application over a
+    bounded ring, they are decompressed and dispatched to on_message by the thread
+    calling i2cp_client_dispatch(). The io thread stops receiving while the ring is
+    full. Other callbacks are dispatched on the io thread.
+    \param[in] dispatch Thread which dispatches received payloads.
+    \return 0 on success, -1 if the thread could not be started.
+ */
+int i2cp_client_start_io_thread(struct i2cp_client_t *self, i2cp_client_dispatch_t dispatch);
+
+/** \brief Stop the io thread and wait for it to exit. */
+void i2cp_client_stop_io_thread(struct i2cp_client_t *self);
+
+/** \brief Get the descriptor which is readable when payloads are ready for
+    i2cp_client_dispatch().
+    \return The descriptor or -1 if not in CLIENT_DISPATCH_CONSUMER mode.
+ */
+int i2cp_client_get_dispatch_fd(struct i2cp_client_t *self);
+
+/** \brief Dispatch payloads handed over by the io thread.
+    Must be called by one thread at a time, the session of a payload must not be
+    destroyed before its payloads are dispatched.
+    \param[in] timeout Max time to wait for payloads in milliseconds, -1 waits
+               until payloads arrive or the io thread ends, 0 does not wait.
+    \return Number of payloads dispatched, -1 if not in CLIENT_DISPATCH_CONSUMER mode.
+ */
+int i2cp_client_dispatch(struct i2cp_client_t *self, int timeout);
+
+/** \brief Start a pool of threads dispatching received payloads.
+    Payloads are decompressed and dispatched to on_message by the worker the session
+    id hashes to, so payloads of a session keep their order while sessions are
+    dispatched in parallel. Takes precedence over the dispatch mode of the io thread.
+    Payloads for a worker which is behind are parked in order while other sessions
+    are received, receiving stops only once too many payloads are parked for one
+    worker. Queued payloads refer to their session, which must not be destroyed
+    before its payloads are dispatched or the workers are stopped.
+    Must be called while the io thread is not running.
+    \param[in] count Number of workers, at most one per session of a client.
+    \return 0 on success, -1 if the workers could not be started.
+ */
+int i2cp_client_start_dispatch_workers(struct i2cp_client_t *self, int count);
+
+/** \brief Stop the dispatch workers, payloads not yet dispatched are dropped.
+    Must be called while the io thread is not running.
+ */
+void i2cp_client_stop_dispatch_workers(struct i2cp_client_t *self);
+
 /** \brief Lookup an i2p address
     \param[in] self
     \param[in] address An i2p address eg. base32 encoded hash with suffix ".b32.i2p"
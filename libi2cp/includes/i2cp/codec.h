@@ -0,0 +1,66 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file codec.h
+    \brief Gzip framing of message payloads.
+
+    The compression library is chosen at configure time, zlib by default or
+    libdeflate or zlib-ng when enabled. All backends produce a gzip stream
+    with a plain 10 byte header which the client patches with ports and
+    protocol.
+*/
+
+#ifndef _codec_h
+#define _codec_h
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+struct stream_t;
+
+/** \brief A gzip compressor and decompressor */
+struct i2cp_codec_t;
+
+/** \brief Construct a codec. */
+struct i2cp_codec_t *i2cp_codec_new();
+
+/** \brief Destroys a codec instance. */
+void i2cp_codec_destroy(struct i2cp_codec_t *self);
+
+/** \brief Get the name of the compression library in use. */
+const char *i2cp_codec_name();
+
+/** \brief Update a crc32 checksum as used in the gzip trailer. */
+uint32_t i2cp_codec_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+/** \brief Compress stream from its current position into a gzip stream.
+    \param[in] level A zlib level 0 to 9 or I2CP_COMPRESSION_STORED.
+    \param[out] out Receives the gzip stream, which is marked ended.
+    \return 0 on success, -1 on failure.
+*/
+int i2cp_codec_compress(struct i2cp_codec_t *self, int level,
+			struct stream_t *in, struct stream_t *out);
+
+/** \brief Decompress a gzip stream from its current position.
+    \param[out] out Receives the payload, which is marked ended.
+    \return 0 on success, -1 on failure.
+*/
+int i2cp_codec_decompress(struct i2cp_codec_t *self,
+			  struct stream_t *in, struct stream_t *out);
+
+#endif
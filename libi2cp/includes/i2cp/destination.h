@@ -19,6 +19,9 @@
 #ifndef _destination_h
 #define _destination_h
 
+#include <stdlib.h>
+#include <inttypes.h>
+
 struct stream_t;
 
 /** \brief An i2p destination */
@@ -58,6 +61,13 @@ void i2cp_destination_to_stream(struct i2cp_destination_t *self, struct stream_t
 /** \brief Get a destination message. */
 void i2cp_destination_get_message(struct i2cp_destination_t *self, struct stream_t *stream);
 
+/** \brief Get the destination message serialized at construction, for sending it
+    without a copy.
+    \param[out] length Length of the message.
+    \return The message, valid until the destination is destroyed.
+ */
+const uint8_t *i2cp_destination_message(const struct i2cp_destination_t *self, size_t *length);
+
 /** \brief Get the signature keypair for the destination.
     If the destination is not ours only the public key is available in the pair.
     \param[in] self The destination to get keypairs from.
@@ -65,15 +75,22 @@ void i2cp_destination_get_message(struct i2cp_destination_t *self, struct stream
  */
 const struct i2cp_signature_keypair_t *i2cp_destination_signature_keypair(struct i2cp_destination_t *self);
 
+/** \brief Get the sha256 hash of the destination message.
+    Generated on first access, usable as lookup key of destinations.
+    \return The 32 byte hash, valid until the destination is destroyed.
+ */
+const uint8_t *i2cp_destination_hash(const struct i2cp_destination_t *self);
+
 /** \brief Retreive the b32 address of the destination.
     A b32 address is the base32 encoded sha256 hash of a desination
-    suffixed with the string ".b32.i2p".
+    suffixed with the string ".b32.i2p". Generated on first access.
     \return A string with a b32 address.
  */
 const char *i2cp_destination_b32(const struct i2cp_destination_t *self);
 
 /** \brief Reretive the b64 address of the destination.
     A b64 destination is the base64 encoded of the raw destination.
+    Generated on first access.
     \return A string with b64 address.
  */
 const char *i2cp_destination_b64(const struct i2cp_destination_t *self);
@@ -48,6 +48,7 @@
 #define DATAGRAM        (1 << 22)
 #define CONFIG_FILE     (1 << 23)
 #define VERSION         (1 << 24)
+#define CODEC           (1 << 25)
 
 #define TAG_MASK        0x0000000f
 #define LEVEL_MASK      0x000001f0
@@ -0,0 +1,47 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _mpsc_h
+#define _mpsc_h
+
+#include <stdatomic.h>
+
+/* Intrusive lock free multi producer single consumer queue, a node is
+   embedded as first member of the queued item. Push is wait free and can
+   be called from any thread, pop must be serialized by the consumer and
+   can return NULL while a producer is in the middle of a push. */
+typedef struct mpsc_node_t
+{
+  _Atomic(struct mpsc_node_t *) next;
+} mpsc_node_t;
+
+typedef struct mpsc_queue_t
+{
+  _Atomic(mpsc_node_t *) head;
+  mpsc_node_t *tail;
+  mpsc_node_t stub;
+} mpsc_queue_t;
+
+void mpsc_init(mpsc_queue_t *self);
+void mpsc_push(mpsc_queue_t *self, mpsc_node_t *node);
+mpsc_node_t *mpsc_pop(mpsc_queue_t *self);
+
+/* only reliable from the consumer */
+int mpsc_is_empty(mpsc_queue_t *self);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ratelimit_h
+#define _ratelimit_h
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+/* Token bucket of bytes refilled at rate per second up to burst, the
+   bucket may go into debt so a single large send is never blocked. */
+struct ratelimit_t;
+struct ratelimit_t *ratelimit_new();
+void ratelimit_destroy(struct ratelimit_t *self);
+
+/* rate 0 disables the limit */
+void ratelimit_set_rate(struct ratelimit_t *self, uint64_t rate, uint64_t burst);
+uint64_t ratelimit_get_rate(struct ratelimit_t *self);
+
+/* bytes available now, unlimited is INT64_MAX */
+int64_t ratelimit_available(struct ratelimit_t *self);
+void ratelimit_consume(struct ratelimit_t *self, size_t bytes);
+
+/* milliseconds until bytes are available */
+int ratelimit_delay(struct ratelimit_t *self);
+
+#endif
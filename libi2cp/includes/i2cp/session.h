@@ -76,7 +76,10 @@ typedef struct i2cp_session_callbacks_t {
   /** \brief An opaque data passed along the callbacks. */
   void * opaque;
 
-  /** \brief Incoming message for the session */
+  /** \brief Incoming message for the session.
+      \param[in] payload The uncompressed payload, only valid during the callback.
+      \see CLIENT_PROP_RECV_ZERO_COPY
+   */
   void (*on_message) (struct i2cp_session_t *session,
 		      i2cp_protocol_t protocol, uint16_t src_port, uint16_t dest_port,
 		      stream_t *payload, void *opaque);
@@ -97,8 +100,47 @@ typedef struct i2cp_session_callbacks_t {
   void (*on_destination) (struct i2cp_session_t *session, uint32_t request_id, const char *address,
 			  struct i2cp_destination_t *destination, void *opaque);
 
+  /** \brief Status of a sent message.
+      Only sent by the router when message reliability of the session is not "none"
+      and the message was sent with a non zero nonce. I2CP_MSG_STATUS_ACCEPTED is
+      followed by a final status when the message is delivered or failed.
+      \param[in] session The session which sent the message.
+      \param[in] nonce The nonce the message was sent with.
+      \param[in] status Status of the message.
+      \param[in] size Size of the message.
+      \see i2cp_session_config_set_send_window
+   */
+  void (*on_message_status) (struct i2cp_session_t *session, uint32_t nonce,
+			     i2cp_session_message_status_t status, uint32_t size, void *opaque);
+
 } i2cp_session_callbacks_t;
 
+/** \brief Statistics of a session */
+typedef struct i2cp_session_stats_t {
+  uint64_t messages_sent;
+  /** \brief Payload bytes before compression */
+  uint64_t payload_bytes_sent;
+  /** \brief Bytes of gzip streams sent */
+  uint64_t compressed_bytes_sent;
+  /** \brief Compression used for last message sent, a zlib level or I2CP_COMPRESSION_STORED */
+  int compression_level;
+  /** \brief Tracked messages waiting for a final status */
+  uint32_t messages_in_flight;
+} i2cp_session_stats_t;
+
+/** \brief Flags of i2cp_send_options_t, see SendMessageExpires in the i2cp specification. */
+#define I2CP_SEND_FLAG_NO_LEASESET_BUNDLE  (1 << 8)  /**< Don't bundle our lease set */
+#define I2CP_SEND_FLAG_TAG_THRESHOLD(n)    (((n) & 0x0f) << 4) /**< Low tag threshold code */
+#define I2CP_SEND_FLAG_TAGS(n)             ((n) & 0x0f) /**< Tags to send code */
+
+/** \brief Options of a message sent with i2cp_session_send_message_ex() */
+typedef struct i2cp_send_options_t {
+  /** \brief Milliseconds until the router drops the message, 0 for no expiration */
+  uint32_t ttl_ms;
+  /** \brief I2CP_SEND_FLAG_* */
+  uint16_t flags;
+} i2cp_send_options_t;
+
 /** \brief Creates a new session object 
     \param[in] client A i2cp_client_t instance which this session belongs to.
     \param[in] cb Configured callback vector for the session object.
@@ -129,14 +171,44 @@ uint16_t i2cp_session_get_id(struct i2cp_session_t *self);
     \param[in] src_port Send message from port
     \param[in] dest_port Send message to port
     \param[in] payload A stream with the payload to send
-    \param[in] nonce A nonce of the message
-    \see i2cp_destination_t i2cp_protocol_t
+    \param[in] nonce A nonce of the message, non zero to track status of the message
+    \return 0 on success, -1 on failure with errno EAGAIN if the send window is full
+            or the send share of the session is used up.
+
+    Thread safe, several threads may send on the same client or session while
+    another runs i2cp_client_process_io(). The message is compressed by the
+    calling thread and queued, it is written by i2cp_client_process_io().
+    A payload stream must not be sent by two threads at once.
+    \see i2cp_destination_t i2cp_protocol_t i2cp_session_callbacks_t::on_message_status
 */
-void i2cp_session_send_message(struct i2cp_session_t *self,
+int i2cp_session_send_message(struct i2cp_session_t *self,
 			       const struct i2cp_destination_t *destination,
 			       i2cp_protocol_t protocol, uint16_t src_port, uint16_t dest_port,
 			       stream_t *payload, uint32_t nonce);
 
+/** \brief Sends a message to destination with options.
+    Uses SendMessageExpires which routers support since 0.9.2, with older routers
+    the options are ignored and the message is sent as i2cp_session_send_message().
+    \param[in] options Expiration and flags of the message, NULL for none.
+    \see i2cp_session_send_message
+*/
+int i2cp_session_send_message_ex(struct i2cp_session_t *self,
+				 const struct i2cp_destination_t *destination,
+				 i2cp_protocol_t protocol, uint16_t src_port, uint16_t dest_port,
+				 stream_t *payload, uint32_t nonce,
+				 const i2cp_send_options_t *options);
+
+/** \brief Get time until the send share of the session is refilled.
+    \return Milliseconds to wait, 0 if the session may send.
+    \see i2cp_session_config_set_send_share
+*/
+int i2cp_session_send_delay(struct i2cp_session_t *self);
+
 /** \brief Get the destination of the session. */
 const struct i2cp_destination_t *i2cp_session_get_destination(struct i2cp_session_t *self);
+
+/** \brief Get a copy of the statistics of the session.
+    \param[out] stats The statistics.
+*/
+void i2cp_session_get_stats(struct i2cp_session_t *self, i2cp_session_stats_t *stats);
 #endif
@@ -57,6 +57,14 @@ typedef enum i2cp_session_config_property_t
   NR_OF_SESSION_CONFIG_PROPERTIES
 } i2cp_session_config_property_t;
 
+/** \brief Payload compression of messages sent by a session.
+ *  Besides these a zlib compression level 0 to 9 can be used.
+ *  \see i2cp_session_config_set_compression
+ */
+#define I2CP_COMPRESSION_AUTO     -1 /**< Choose per payload */
+#define I2CP_COMPRESSION_STORED   -2 /**< Stored gzip blocks, no deflate */
+#define I2CP_COMPRESSION_DEFAULT   9
+
 /** \brief Constructs a session config instance.
  *  \param[in] dest_fname A filename to load destination for a file, NULL if a
  *              new destination should be generated.
@@ -76,6 +84,12 @@ void i2cp_session_config_set_property(struct i2cp_session_config_t *self,
 				      i2cp_session_config_property_t prop,
 				      const char *value);
 
+/** \brief Get a property of the session config instance.
+ *  \return The value or NULL if the property is not set.
+ */
+const char *i2cp_session_config_get_property(struct i2cp_session_config_t *self,
+					     i2cp_session_config_property_t prop);
+
 /** \brief Writes protocol message of the session config instance.
  *  \param[in] self The instance of session config
  *  \param[out] stream The output stream for the session config data structure. 
@@ -83,4 +97,35 @@ void i2cp_session_config_set_property(struct i2cp_session_config_t *self,
 void i2cp_session_config_get_message(struct i2cp_session_config_t *self, stream_t *stream);
 
 struct i2cp_destination_t *i2cp_session_config_get_destination(struct i2cp_session_config_t *self);
+
+/** \brief Set payload compression of messages sent by the session.
+ *  Already compressed or encrypted payloads gain nothing from compression,
+ *  I2CP_COMPRESSION_STORED sends them in a gzip stream of stored blocks at the
+ *  cost of a crc32 and copy. Defaults to I2CP_COMPRESSION_DEFAULT.
+ *  \param[in] level A zlib level 0 to 9, I2CP_COMPRESSION_STORED or I2CP_COMPRESSION_AUTO.
+ */
+void i2cp_session_config_set_compression(struct i2cp_session_config_t *self, int level);
+
+/** \brief Get payload compression of messages sent by the session. */
+int i2cp_session_config_get_compression(struct i2cp_session_config_t *self);
+
+/** \brief Set max number of tracked messages in flight for the session.
+ *  Messages are tracked when SESSION_CONFIG_PROP_I2CP_MESSAGE_RELIABILITY is set to
+ *  other than "none" and sent with a non zero nonce. Sending more messages fails
+ *  until the router reports a final status of earlier ones. Defaults to 0, unlimited.
+ */
+void i2cp_session_config_set_send_window(struct i2cp_session_config_t *self, uint32_t window);
+
+/** \brief Get max number of tracked messages in flight for the session. */
+uint32_t i2cp_session_config_get_send_window(struct i2cp_session_config_t *self);
+
+/** \brief Set the share of the client send rate the session may use.
+ *  When the client shapes its output with CLIENT_PROP_SEND_RATE, sending more payload
+ *  bytes than the share fails until the share is refilled. Defaults to 0, unlimited.
+ *  \param[in] percent Share of client send rate in percent, 0 to 100.
+ */
+void i2cp_session_config_set_send_share(struct i2cp_session_config_t *self, uint8_t percent);
+
+/** \brief Get the share of the client send rate the session may use. */
+uint8_t i2cp_session_config_get_send_share(struct i2cp_session_config_t *self);
 #endif
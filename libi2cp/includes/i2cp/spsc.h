@@ -0,0 +1,42 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _spsc_h
+#define _spsc_h
+
+#include <inttypes.h>
+
+/* Bounded lock free single producer single consumer ring of pointers, one
+   thread may push while another pops. The size is rounded up to a power of
+   two. */
+struct spsc_t;
+
+struct spsc_t *spsc_new(uint32_t size);
+void spsc_destroy(struct spsc_t *self);
+
+/* returns -1 if the ring is full */
+int spsc_push(struct spsc_t *self, void *item);
+
+/* returns NULL if the ring is empty */
+void *spsc_pop(struct spsc_t *self);
+
+uint32_t spsc_count(struct spsc_t *self);
+int spsc_is_full(struct spsc_t *self);
+int spsc_is_empty(struct spsc_t *self);
+
+#endif
@@ -75,9 +75,9 @@ static inline void stream_check(stream_t *s, int len) {
 
 #define stream_in_uint8(s,v)     { stream_check(s, 1); v = *((s)->p++); }
 #define stream_in_uint8p(s,v,a)  { stream_check(s, a); memcpy(v, (s)->p, a); (s)->p += a; }
-#define stream_in_uint16(s,v)    { stream_check(s, 2); v = (uint16_t)*((s)->p++) << 8 | *((s)->p++);}
-#define stream_in_uint32(s,v)    { stream_check(s, 4); v = (uint32_t)*((s)->p++) << 24 | (uint32_t)*((s)->p++) << 16 | (uint32_t)*((s)->p++) << 8 | (uint32_t)*((s)->p++) << 0 ;}
-#define stream_in_uint64(s,v)    { stream_check(s, 8); v = (uint64_t)*((s)->p++) << 56 | (uint64_t)*((s)->p++) << 48 | (uint64_t)*((s)->p++) << 40 | (uint64_t)*((s)->p++) << 32 | (uint64_t)*((s)->p++) << 24 | (uint64_t)*((s)->p++) << 16 | (uint64_t)*((s)->p++) << 8 | (uint64_t)*((s)->p++) << 0 ;}
+#define stream_in_uint16(s,v)    { stream_check(s, 2); v = (uint16_t)(s)->p[0] << 8 | (s)->p[1]; (s)->p += 2; }
+#define stream_in_uint32(s,v)    { stream_check(s, 4); v = (uint32_t)(s)->p[0] << 24 | (uint32_t)(s)->p[1] << 16 | (uint32_t)(s)->p[2] << 8 | (uint32_t)(s)->p[3]; (s)->p += 4; }
+#define stream_in_uint64(s,v)    { stream_check(s, 8); v = (uint64_t)(s)->p[0] << 56 | (uint64_t)(s)->p[1] << 48 | (uint64_t)(s)->p[2] << 40 | (uint64_t)(s)->p[3] << 32 | (uint64_t)(s)->p[4] << 24 | (uint64_t)(s)->p[5] << 16 | (uint64_t)(s)->p[6] << 8 | (uint64_t)(s)->p[7]; (s)->p += 8; }
 
 #define stream_out_uint8(s,v)     { stream_check(s, 1); *((s)->p++) = v; }
 #define stream_out_uint8p(s,v,a)  { stream_check(s, a); memcpy((s)->p, v, a); (s)->p += a; }
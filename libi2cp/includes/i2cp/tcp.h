@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <inttypes.h>
+#include <sys/uio.h>
 
 #include <i2cp/config.h>
 
@@ -29,16 +30,44 @@ typedef enum tcp_property_t
 {
   TCP_PROP_ADDRESS,
   TCP_PROP_PORT,
+  /** Connect to a unix domain socket at this path instead of address and port,
+      also used if the address is of the form unix:/path */
+  TCP_PROP_UNIX_PATH,
 
 #ifdef WITH_GNUTLS
   TCP_PROP_USE_TLS,
   TCP_PROP_TLS_CLIENT_CERTIFICATE,
+  /** PEM file of trusted CAs, when set the handshake fails if the peer
+      certificate isn't trusted. Default is the system CA bundle, with which
+      an untrusted certificate is accepted with a warning. */
+  TCP_PROP_TLS_CA_FILE,
+  /** PEM file of the router certificate, when set the router must present
+      exactly this certificate and CAs are not used */
+  TCP_PROP_TLS_PINNED_CERTIFICATE,
+#endif
+
+#ifdef WITH_IO_URING
+  /** Set to "1" to use io_uring for io of the connection. */
+  TCP_PROP_USE_IO_URING,
 #endif
 
   NR_OF_TCP_PROPERTIES
 } tcp_property_t;
 
+typedef enum tcp_state_t
+{
+  TCP_STATE_DISCONNECTED,
+  TCP_STATE_RESOLVING,
+  TCP_STATE_CONNECTING,
+  TCP_STATE_TLS_HANDSHAKE,
+  TCP_STATE_CONNECTED
+} tcp_state_t;
+
+/* tcp_sendv() flags */
+#define TCP_SEND_NONBLOCK (1 << 0)
+
 struct tcp_t;
+struct stream_t;
 
 void tcp_init();
 void tcp_deinit();
@@ -50,12 +79,55 @@ void tcp_set_property(struct tcp_t *self, tcp_property_t prop, const char *value
 const char * tcp_get_property(struct tcp_t *self, tcp_property_t prop);
 
 void tcp_connect(struct tcp_t *self);
+
+/** Start a non blocking connect which is advanced by tcp_connect_continue()
+    when the socket is ready as indicated by tcp_get_fd() and tcp_wants_write(). */
+void tcp_connect_start(struct tcp_t *self);
+
+/** Advance a connect started by tcp_connect_start() without blocking.
+    \return The new state, TCP_STATE_DISCONNECTED if the connect failed. */
+tcp_state_t tcp_connect_continue(struct tcp_t *self);
+
+/** Wait at most timeout milliseconds, or forever if negative, for the
+    hostname lookup of a connect in TCP_STATE_RESOLVING to finish. */
+void tcp_wait_resolve(struct tcp_t *self, int timeout);
+
+tcp_state_t tcp_get_state(struct tcp_t *self);
+
+/** Returns non zero if the socket needs to be polled for writability for
+    the connect or a previous send to progress. */
+int tcp_wants_write(struct tcp_t *self);
+
 void tcp_disconnect(struct tcp_t *self);
 int tcp_is_connected(struct tcp_t *self);
 
 int tcp_send(struct tcp_t *self, struct stream_t *stream);
+
+/** Send a vector of buffers. With TCP_SEND_NONBLOCK only what fits in the
+    socket buffer is sent and 0 is returned if nothing could be sent.
+    \return bytes sent, which may be less than the total of the vector,
+    or < 0 on error. */
+int tcp_sendv(struct tcp_t *self, const struct iovec *iov, int iovcnt, int flags);
+
 int tcp_recv(struct tcp_t *self, struct stream_t *stream, size_t length);
 
+/** Receive without blocking, returns -1 with errno set to EAGAIN if there is
+    nothing to read. */
+int tcp_recv_nonblock(struct tcp_t *self, struct stream_t *stream, size_t length);
+
 int tcp_can_read(struct tcp_t *self);
 
+/** Get the descriptor to poll for io, -1 if not connected or while resolving
+    the address. This is the io_uring descriptor when io_uring is used. */
+int tcp_get_fd(struct tcp_t *self);
+
+/** Returns non zero if data accepted by a previous send still needs to be
+    flushed to the socket. */
+int tcp_send_pending(struct tcp_t *self);
+
+/** Returns non zero if a send can't accept data until pending sends complete.
+    This is the case for a full io_uring send ring, the completions freeing
+    space are signaled by readability of tcp_get_fd() and not writability. */
+int tcp_send_blocked(struct tcp_t *self);
+
 #endif
@@ -17,18 +17,37 @@
 */
 
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
-#include <zlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+
+#include <i2cp/config.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #include <i2cp/client.h>
+#include <i2cp/codec.h>
+#include <i2cp/ratelimit.h>
+#include <i2cp/mpsc.h>
+#include <i2cp/spsc.h>
 #include <i2cp/destination.h>
 #include <i2cp/lease.h>
 #include <i2cp/session.h>
 #include <i2cp/session_config.h>
 #include <i2cp/crypto.h>
 #include <i2cp/tcp.h>
-#include <i2cp/queue.h>
 #include <i2cp/stringmap.h>
 #include <i2cp/config_file.h>
 #include <i2cp/version.h>
@@ -39,8 +58,24 @@
 
 #define I2CP_PROTOCOL_INIT 0x2a
 #define I2CP_MESSAGE_SIZE 0xffff
-#define I2CP_MAX_SESSIONS 0xffff
+#define I2CP_RECV_BUFFER_SIZE 0x20000
+#define I2CP_SEND_BUFFER_SIZE 0x20000
 #define I2CP_MAX_SESSIONS_PER_CLIENT 32
+#define I2CP_SESSION_MAP_SIZE 64
+#define I2CP_MSG_TYPES 256
+#define I2CP_DISPATCH_RING_SIZE 1024
+#define I2CP_DISPATCH_PARK_LIMIT 1024
+
+/* automatic compression: payloads below min size are stored, bytes are
+   sampled to detect incompressible data and deflate ratios are remembered
+   per destination, destinations with a ratio above the limit (per mille)
+   are stored and deflate is retried after a number of messages */
+#define I2CP_COMPRESSION_AUTO_MIN_SIZE 64
+#define I2CP_COMPRESSION_AUTO_LEVEL 6
+#define I2CP_COMPRESSION_AUTO_SAMPLES 256
+#define I2CP_COMPRESSION_AUTO_RATIO_LIMIT 900
+#define I2CP_COMPRESSION_AUTO_RETRY 16
+#define I2CP_COMPRESSION_RATIO_CACHE_SIZE 64
 
 #define I2CP_MSG_ANY                        0
 #define I2CP_MSG_BANDWIDTH_LIMITS          23
@@ -59,11 +94,13 @@
 #define I2CP_MSG_REQUEST_LEASESET          21
 #define I2CP_MSG_REQUEST_VARIABLE_LEASESET 37
 #define I2CP_MSG_SEND_MESSAGE               5
+#define I2CP_MSG_SEND_MESSAGE_EXPIRES      36
 #define I2CP_MSG_SESSION_STATUS            20
 #define I2CP_MSG_SET_DATE                  33
 
 /* Router capabilities */
 #define ROUTER_CAN_HOST_LOOKUP              1
+#define ROUTER_CAN_SEND_MESSAGE_EXPIRES     2
 
 /* I2CP_MSG_HOST_LOOKUP types */
 enum {
@@ -71,32 +108,174 @@ enum {
   HOST_LOOKUP_TYPE_HOST
 };
 
+typedef struct _client_compression_ratio_t
+{
+  uint64_t key;
+  uint16_t ratio;
+  uint16_t stored;
+} _client_compression_ratio_t;
+
+/* per thread scratch of the send path, every sending thread serializes
+   messages and compresses into its own streams and codec */
+typedef struct _client_send_scratch_t
+{
+  stream_t message_stream;
+  stream_t deflate_stream;
+  struct i2cp_codec_t *codec;
+  _client_compression_ratio_t ratios[I2CP_COMPRESSION_RATIO_CACHE_SIZE];
+} _client_send_scratch_t;
+
+/* framed message on the send queue */
+typedef struct _client_send_node_t
+{
+  mpsc_node_t node;
+  size_t length;
+  uint8_t data[];
+} _client_send_node_t;
+
+/* payload message handed to the consumer thread or a worker, next links
+   payloads parked while the ring of their worker is full */
+typedef struct _client_dispatch_item_t
+{
+  struct _client_dispatch_item_t *next;
+  struct i2cp_session_t *session;
+  size_t length;
+  uint8_t data[];
+} _client_dispatch_item_t;
+
+/* dispatch worker of i2cp_client_start_dispatch_workers() */
+typedef struct _client_worker_t
+{
+  struct i2cp_client_t *client;
+  pthread_t thread;
+  struct spsc_t *ring;
+  int wake[2];
+  int signal;
+  atomic_int stop;
+  struct i2cp_codec_t *codec;
+  stream_t inflate_stream;
+
+  /* payloads waiting for room on the ring, owned by the thread running io */
+  _client_dispatch_item_t *parked_head;
+  _client_dispatch_item_t *parked_tail;
+  int parked;
+} _client_worker_t;
+
+typedef struct _client_message_handler_t
+{
+  i2cp_client_message_handler_t fn;
+  void *opaque;
+} _client_message_handler_t;
+
 typedef struct i2cp_client_t
 {
   i2cp_logger_callbacks_t logger;
   i2cp_client_callbacks_t *callbacks;
 
+  i2cp_client_state_t state;
+
+  /* message handlers indexed by message type */
+  _client_message_handler_t handlers[I2CP_MSG_TYPES];
+
   const char * properties[NR_OF_I2CP_CLIENT_PROPERTIES];
   struct tcp_t * tcp;
 
-  stream_t output_stream;
-  stream_t message_stream;
+  /* decompresses received payloads */
+  struct i2cp_codec_t *codec;
+
+  /* receive buffer, data..p is consumed, p..end holds received data not
+     yet framed into messages and end..size is free for the next read. */
+  stream_t input_stream;
+
+  /* payloads are decompressed into inflate stream by the receive path,
+     stored payloads are dispatched without copy if recv_zero_copy is set */
+  stream_t inflate_stream;
+  int recv_zero_copy;
 
   struct {
     uint64_t date;
+    /* router date minus local date in milliseconds */
+    int64_t date_offset;
     struct i2cp_version_t *version;
     uint32_t capabilities;
   } router;
 
-  /* TODO: We should probably replace the output queue to a ringbuffer based on stream_t
-           to optimize away all the allocs() done when putting on outqueue.
-   */
-  struct queue_t *output_queue;
-
-  struct i2cp_session_t *sessions[I2CP_MAX_SESSIONS];
+  /* output queue, data..p is sent, p..end holds framed messages queued for
+     send and end..size is free. Messages are serialized in place at end and
+     the buffer is compacted or grown when a message doesn't fit. */
+  stream_t output_stream;
+  pthread_mutex_t output_lock;
+
+  /* messages of senders which found the output lock taken, moved to the
+     output queue by the holder of the output lock before it is flushed.
+     Their bytes count towards the high water mark while queued. */
+  mpsc_queue_t send_queue;
+  atomic_size_t send_queue_bytes;
+
+  /* max bytes sent per flush of output queue, 0 is unlimited */
+  uint32_t send_batch_bytes;
+
+  /* bandwidth limits reported by router and the shaper of output queue,
+     guarded by output_lock */
+  i2cp_bandwidth_limits_t bandwidth_limits;
+  int has_bandwidth_limits;
+  struct ratelimit_t *shaper;
+
+  /* output queue size which triggers on_backpressure, 0 is disabled */
+  uint32_t send_high_water;
+  int send_above_water;
+
+  /* sessions by slot and a map of session id to slot + 1, an open
+     addressed table with linear probing twice the size of slots */
+  struct i2cp_session_t *sessions[I2CP_MAX_SESSIONS_PER_CLIENT];
+  uint16_t session_ids[I2CP_MAX_SESSIONS_PER_CLIENT];
+  uint8_t session_map[I2CP_SESSION_MAP_SIZE];
   int session_count;
 
-  /* mapping table for address lookups */
+  /* sessions waiting for SessionStatus in order of creation, the first
+     pending_sessions_sent has been sent to router and the rest is sent
+     when the client is ready. */
+  struct i2cp_session_t *pending_sessions[I2CP_MAX_SESSIONS_PER_CLIENT];
+  int pending_session_count;
+  int pending_sessions_sent;
+
+  /* event loop used by i2cp_client_run() */
+  int poll_fd;
+  int poll_registered_fd;
+  uint32_t poll_events;
+  int poll_wake_registered;
+
+  /* io thread of i2cp_client_start_io_thread(), senders wake it through
+     io_wake unless io_wake_pending is already set */
+  pthread_t io_thread;
+  int io_thread_running;
+  atomic_int io_stop;
+  int io_wake[2];
+  atomic_int io_wake_pending;
+
+  /* payloads handed to the consumer thread with CLIENT_DISPATCH_CONSUMER,
+     dispatch_wake is signaled after payloads were pushed. The io thread
+     stops receiving while the ring is full and sets dispatch_blocked for
+     the consumer to wake it, workers are asked the same while payloads
+     are parked. */
+  i2cp_client_dispatch_t dispatch;
+  struct spsc_t *dispatch_ring;
+  int dispatch_wake[2];
+  int dispatch_signal;
+  atomic_int dispatch_blocked;
+  struct i2cp_codec_t *dispatch_codec;
+  stream_t dispatch_stream;
+
+  /* payloads of a session are dispatched by the worker its id hashes to,
+     which takes precedence over the dispatch mode. Payloads for a worker
+     with a full ring are parked in order, receive stops only once a worker
+     has I2CP_DISPATCH_PARK_LIMIT payloads parked. */
+  _client_worker_t *workers;
+  int worker_count;
+
+  /* mapping table for address lookups, requested from any thread and
+     answered on the io thread */
+  pthread_mutex_t lookup_lock;
   struct stringmap_t *lookups;
   struct intmap_t *lookup_requests;
   uint32_t lookup_request_id;
@@ -118,10 +297,144 @@ extern void _session_dispatch_message(struct i2cp_session_t *session,
 				      stream_t *payload);
 
 extern void _session_dispatch_session_status(struct i2cp_session_t *session, i2cp_session_status_t status);
+extern void _session_dispatch_message_status(struct i2cp_session_t *self, uint32_t message_id,
+					     i2cp_session_message_status_t status, uint32_t size,
+					     uint32_t nonce);
+
+extern void _i2cp_session_set_id(struct i2cp_session_t *self, uint16_t session_id);
+extern void _session_account_send(struct i2cp_session_t *self, int level,
+				  size_t payload_size, size_t compressed_size);
 
 extern void _session_dispatch_destination(struct i2cp_session_t *session, uint32_t request_id,
 					  char *address, struct i2cp_destination_t *destination);
 
+static void _client_ready(i2cp_client_t *self);
+
+/* Fibonacci hash of session id into the 6 bits of session map index */
+static inline uint32_t
+_client_session_hash(uint16_t session_id)
+{
+  return ((uint32_t)session_id * 0x9e3779b1) >> 26;
+}
+
+/* Find index in session map of session id, or the empty index where it
+   would be inserted. */
+static inline uint32_t
+_client_session_index(i2cp_client_t *self, uint16_t session_id)
+{
+  uint32_t i;
+
+  i = _client_session_hash(session_id);
+  while (self->session_map[i] && self->session_ids[self->session_map[i] - 1] != session_id)
+    i = (i + 1) % I2CP_SESSION_MAP_SIZE;
+
+  return i;
+}
+
+static struct i2cp_session_t *
+_client_session_get(i2cp_client_t *self, uint16_t session_id)
+{
+  uint32_t i;
+
+  i = _client_session_index(self, session_id);
+  return self->session_map[i] ? self->sessions[self->session_map[i] - 1] : NULL;
+}
+
+static void
+_client_session_add(i2cp_client_t *self, uint16_t session_id, struct i2cp_session_t *session)
+{
+  int slot;
+  uint32_t i;
+
+  /* a known session id is reused by router, replace its session */
+  i = _client_session_index(self, session_id);
+  if (self->session_map[i])
+  {
+    self->sessions[self->session_map[i] - 1] = session;
+    return;
+  }
+
+  for (slot = 0; slot < I2CP_MAX_SESSIONS_PER_CLIENT && self->sessions[slot]; slot++);
+  if (slot == I2CP_MAX_SESSIONS_PER_CLIENT)
+  {
+    warning(TAG, "No free slot for session id %d.", session_id);
+    return;
+  }
+
+  self->sessions[slot] = session;
+  self->session_ids[slot] = session_id;
+  self->session_map[i] = slot + 1;
+  self->session_count++;
+}
+
+static void
+_client_session_remove(i2cp_client_t *self, uint16_t session_id)
+{
+  uint32_t i, j, k;
+
+  i = _client_session_index(self, session_id);
+  if (self->session_map[i] == 0)
+    return;
+
+  self->sessions[self->session_map[i] - 1] = NULL;
+  self->session_map[i] = 0;
+  self->session_count--;
+
+  /* shift following entries of the probe sequence back into the hole */
+  for (j = (i + 1) % I2CP_SESSION_MAP_SIZE; self->session_map[j];
+       j = (j + 1) % I2CP_SESSION_MAP_SIZE)
+  {
+    k = _client_session_hash(self->session_ids[self->session_map[j] - 1]);
+    if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+    {
+      self->session_map[i] = self->session_map[j];
+      self->session_map[j] = 0;
+      i = j;
+    }
+  }
+}
+static void _client_msg_get_bandwidth_limits(i2cp_client_t *self, int queue);
+
+/* Set rate of output queue shaper from CLIENT_PROP_SEND_RATE, the router
+   limits are the client outbound limit or else the router outbound and
+   burst limits. Called with output_lock held. */
+static void
+_client_shaper_update(i2cp_client_t *self)
+{
+  const char *value;
+  uint64_t rate, burst;
+  i2cp_bandwidth_limits_t *bw;
+
+  rate = burst = 0;
+  value = self->properties[CLIENT_PROP_SEND_RATE];
+  if (value && strcmp(value, "router") == 0)
+  {
+    bw = &self->bandwidth_limits;
+    if (self->has_bandwidth_limits)
+    {
+      rate = (uint64_t)(bw->client_outbound ? bw->client_outbound : bw->router_outbound) * 1024;
+      /* bucket allows sending at burst rate for the burst time */
+      burst = (uint64_t)bw->router_outbound_burst * 1024 * bw->router_burst_time;
+    }
+  }
+  else if (value)
+    rate = strtoull(value, NULL, 10);
+
+  ratelimit_set_rate(self->shaper, rate, burst);
+}
+
+/* Keep non static due to internal i2cp lib access from session.c */
+uint64_t
+_client_send_rate(i2cp_client_t *self)
+{
+  uint64_t rate;
+
+  pthread_mutex_lock(&self->output_lock);
+  rate = ratelimit_get_rate(self->shaper);
+  pthread_mutex_unlock(&self->output_lock);
+
+  return rate;
+}
 static void _client_msg_create_lease_set(i2cp_client_t *self, struct i2cp_session_t *session,
 					 uint8_t tunnels, struct i2cp_lease_t **leases, int queue);
 
@@ -153,9 +466,15 @@ _client_config_file_parse_callback(const char *name, const char *value, void *op
     client->properties[CLIENT_PROP_ROUTER_ADDRESS] = strdup(value);
   else if (strcmp(name, "i2cp.tcp.port") == 0)
     client->properties[CLIENT_PROP_ROUTER_PORT] = strdup(value);
+  else if (strcmp(name, "i2cp.unix.path") == 0)
+    client->properties[CLIENT_PROP_ROUTER_UNIX_PATH] = strdup(value);
 #ifdef WITH_GNUTLS
   else if (strcmp(name, "i2cp.tcp.SSL") == 0)
     client->properties[CLIENT_PROP_ROUTER_USE_TLS] = strdup(value);
+  else if (strcmp(name, "i2cp.tcp.SSL.caFile") == 0)
+    client->properties[CLIENT_PROP_ROUTER_TLS_CA_FILE] = strdup(value);
+  else if (strcmp(name, "i2cp.tcp.SSL.pinnedCertificate") == 0)
+    client->properties[CLIENT_PROP_ROUTER_TLS_PINNED_CERTIFICATE] = strdup(value);
 #endif
   else if (strcmp(name, "i2cp.username") == 0)
     client->properties[CLIENT_PROP_USERNAME] = strdup(value);
@@ -251,12 +570,36 @@ _client_dispatch_on_disconnect(i2cp_client_t *self, const char *message)
   self->callbacks->on_disconnect(self, message, self->callbacks->opaque);  
 }
 
+static void
+_client_dispatch_on_connected(i2cp_client_t *self)
+{
+  if (self->callbacks == NULL || self->callbacks->on_connected == NULL)
+    return;
+
+  self->callbacks->on_connected(self, self->callbacks->opaque);
+}
+
+static void
+_client_dispatch_on_session_status(i2cp_client_t *self, struct i2cp_session_t *session, int status)
+{
+  if (self->callbacks == NULL || self->callbacks->on_session_status == NULL)
+    return;
+
+  self->callbacks->on_session_status(self, session, status, self->callbacks->opaque);
+}
+
 static void
 _client_on_msg_set_date(i2cp_client_t *self, stream_t *stream, void *opaque)
 {
+  struct timeval tp;
+
   debug(TAG | PROTOCOL, "%s", "Received SetDate message.");
   stream_in_uint64(stream, self->router.date);
 
+  gettimeofday(&tp, NULL);
+  self->router.date_offset = (int64_t)self->router.date
+    - ((int64_t)tp.tv_sec * 1000 + tp.tv_usec / 1000);
+
   self->router.version = i2cp_version_new_from_stream(stream);
   debug(TAG, "Router version %s, date %ld", i2cp_version_to_string(self->router.version), self->router.date);
 
@@ -264,6 +607,12 @@ _client_on_msg_set_date(i2cp_client_t *self, stream_t *stream, void *opaque)
   if (i2cp_version_cmp(self->router.version, 0, 9, 10, 0) >= 0)
     self->router.capabilities |= ROUTER_CAN_HOST_LOOKUP;
 
+  /* flags and 6 byte expiration of SendMessageExpires */
+  if (i2cp_version_cmp(self->router.version, 0, 9, 2, 0) >= 0)
+    self->router.capabilities |= ROUTER_CAN_SEND_MESSAGE_EXPIRES;
+
+  if (self->state == I2CP_CLIENT_STATE_AWAIT_SETDATE)
+    _client_ready(self);
 }
 
 static void
@@ -284,81 +633,319 @@ _client_on_msg_disconnect(i2cp_client_t *self, stream_t *stream, void *opaque)
   free(string);
 }
 
-static void
-_client_stream_deflate(stream_t *in, stream_t *out)
+/* Check for the magic bytes of formats which are already compressed or
+   encrypted. */
+static int
+_client_payload_is_compressed(const uint8_t *p, size_t len)
 {
-  int ret;
-  z_stream zs;
+  if (len < 6)
+    return 0;
+
+  /* gzip, zstd, xz, bzip2, zip, png, jpeg */
+  if ((p[0] == 0x1f && p[1] == 0x8b)
+      || memcmp(p, "\x28\xb5\x2f\xfd", 4) == 0
+      || memcmp(p, "\xfd" "7zXZ\0", 6) == 0
+      || memcmp(p, "BZh", 3) == 0
+      || memcmp(p, "PK\x03\x04", 4) == 0
+      || memcmp(p, "\x89PNG", 4) == 0
+      || memcmp(p, "\xff\xd8\xff", 3) == 0)
+    return 1;
+
+  /* tls record of change cipher spec, alert, handshake or application data */
+  if (p[0] >= 0x14 && p[0] <= 0x17 && p[1] == 0x03 && p[2] <= 0x04)
+    return 1;
+
+  return 0;
+}
+
+/* Count pairs of equal values in a histogram */
+static uint32_t
+_client_histogram_pairs(const uint16_t *hist)
+{
+  int i;
+  uint32_t pairs;
+
+  pairs = 0;
+  for (i = 0; i < 256; i++)
+    pairs += hist[i] * (hist[i] - 1);
 
-  memset(&zs, 0, sizeof(zs));
-  zs.next_in = in->p;
-  zs.avail_in = stream_length(in) - stream_tell(in);
-  zs.next_out = out->data;
-  zs.avail_out = stream_size(out);
-  zs.zalloc = Z_NULL;
-  zs.zfree = Z_NULL;
-  zs.opaque = Z_NULL;
+  return pairs;
+}
 
-  ret = deflateInit2(&zs, 9, Z_DEFLATED, MAX_WBITS+16, 9, Z_DEFAULT_STRATEGY);
-  if (ret != Z_OK)
+/* Estimate whether payload looks random from histograms of bytes and of
+   differences between neighbouring bytes in a few sampled windows. For
+   uniform random bytes the number of pairs of equal values is about
+   n(n-1)/256, text and structured data give several times more in one
+   of the histograms. */
+static int
+_client_payload_is_random(const uint8_t *p, size_t len)
+{
+  size_t i, j, n, window, step;
+  uint16_t bytes[256], deltas[256];
+
+  window = I2CP_COMPRESSION_AUTO_SAMPLES / 4;
+  step = (len - 1) / 4;
+  if (step < window)
+    step = window = len / 4;
+
+  memset(bytes, 0, sizeof(bytes));
+  memset(deltas, 0, sizeof(deltas));
+  n = 0;
+  for (i = 0; i < 4; i++)
   {
-    warning(TAG, "Failed to initialize deflate of stream with reason: %s", zs.msg);
-    return;
-  }  
+    for (j = i * step; j < i * step + window; j++)
+    {
+      bytes[p[j]]++;
+      /* last window of a short payload ends at the payload end */
+      if (j + 1 < len)
+	deltas[(uint8_t)(p[j + 1] - p[j])]++;
+      n++;
+    }
+  }
+
+  return _client_histogram_pairs(bytes) * 256 < 2 * n * (n - 1)
+    && _client_histogram_pairs(deltas) * 256 < 2 * n * (n - 1);
+}
+
+/* Get the deflate ratio entry of destination, key is the beginning of the
+   public key in the destination message. */
+static _client_compression_ratio_t *
+_client_compression_ratio(_client_send_scratch_t *self, const uint8_t *destination)
+{
+  uint64_t key;
+  _client_compression_ratio_t *entry;
 
-  /* compress of stream */
-  ret = deflate(&zs, Z_FINISH);
-  if (ret != Z_STREAM_END)
+  memcpy(&key, destination, sizeof(key));
+  entry = &self->ratios[key % I2CP_COMPRESSION_RATIO_CACHE_SIZE];
+  if (entry->key != key)
   {
-    warning(TAG, "Failed to deflate of stream with reason %d: %s", ret, zs.msg);
-    deflateEnd(&zs);
-    return;
+    entry->key = key;
+    entry->ratio = 0;
+    entry->stored = 0;
   }
 
-  out->p += zs.total_out;
-  stream_mark_end(out);
+  return entry;
+}
+
+/* Choose compression of a payload for automatic compression */
+static int
+_client_compression_choose(_client_compression_ratio_t *entry, stream_t *payload)
+{
+  size_t len;
+
+  len = stream_length(payload);
+  if (len < I2CP_COMPRESSION_AUTO_MIN_SIZE
+      || _client_payload_is_compressed(payload->data, len)
+      || _client_payload_is_random(payload->data, len))
+    return I2CP_COMPRESSION_STORED;
+
+  if (entry->ratio > I2CP_COMPRESSION_AUTO_RATIO_LIMIT
+      && ++entry->stored < I2CP_COMPRESSION_AUTO_RETRY)
+    return I2CP_COMPRESSION_STORED;
+
+  entry->stored = 0;
+  return I2CP_COMPRESSION_AUTO_LEVEL;
+}
+
+static pthread_key_t _client_send_scratch_key;
+static pthread_once_t _client_send_scratch_once = PTHREAD_ONCE_INIT;
+
+static void
+_client_send_scratch_free(void *opaque)
+{
+  _client_send_scratch_t *scratch;
+
+  scratch = (_client_send_scratch_t *)opaque;
+  stream_destroy(&scratch->message_stream);
+  stream_destroy(&scratch->deflate_stream);
+  i2cp_codec_destroy(scratch->codec);
+  free(scratch);
+}
+
+static void
+_client_send_scratch_init(void)
+{
+  pthread_key_create(&_client_send_scratch_key, _client_send_scratch_free);
+}
+
+/* Get the send scratch of calling thread, created at its first send and
+   freed when the thread exits */
+static _client_send_scratch_t *
+_client_send_scratch()
+{
+  _client_send_scratch_t *scratch;
+
+  pthread_once(&_client_send_scratch_once, _client_send_scratch_init);
+  scratch = pthread_getspecific(_client_send_scratch_key);
+  if (scratch)
+    return scratch;
+
+  scratch = malloc(sizeof(_client_send_scratch_t));
+  memset(scratch, 0, sizeof(_client_send_scratch_t));
+  stream_init(&scratch->message_stream, I2CP_MESSAGE_SIZE);
+  stream_init(&scratch->deflate_stream, I2CP_MESSAGE_SIZE);
+  scratch->codec = i2cp_codec_new();
+  pthread_setspecific(_client_send_scratch_key, scratch);
+
+  return scratch;
+}
+
+/* Setup view of the payload of a gzip stream of one stored block, as sent
+   with I2CP_COMPRESSION_STORED. Returns 1 if view is setup, 0 if the stream
+   needs to be inflated and -1 on crc or size mismatch. */
+static int
+_client_payload_stored_view(stream_t *gzip, stream_t *view)
+{
+  uint8_t *block, *trailer;
+  uint32_t len, crc, isize;
+
+  if (gzip->end - gzip->p < 10 + 5 + 8)
+    return 0;
+
+  /* no gzip flags and a single final stored block filling the stream */
+  block = gzip->p + 10;
+  if (gzip->p[3] != 0 || block[0] != 0x01)
+    return 0;
+
+  len = block[1] | block[2] << 8;
+  if ((block[3] | block[4] << 8) != (~len & 0xffff)
+      || gzip->end - gzip->p != 10 + 5 + len + 8)
+    return 0;
+
+  trailer = block + 5 + len;
+  crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+  isize = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t)trailer[7] << 24;
+  if (isize != len || crc != i2cp_codec_crc32(0, block + 5, len))
+    return -1;
 
-  deflateEnd(&zs);
-  return;
+  view->data = view->p = block + 5;
+  view->size = len;
+  view->end = view->data + len;
+  return 1;
 }
 
+/* Decompress payload of a PayloadMessage positioned at the payload size
+   and dispatch it to session. Runs on the io thread or the consumer thread
+   which pass their own codec and inflate stream. */
 static void
-_client_stream_inflate(stream_t *in, stream_t *out)
+_client_payload_dispatch(i2cp_client_t *self, struct i2cp_session_t *session, stream_t *stream,
+			 struct i2cp_codec_t *codec, stream_t *inflate)
 {
   int ret;
-  z_stream zs;
-
-  /* initialize inflate of raw gzip stream */
-  memset(&zs, 0, sizeof(zs));
-  zs.next_in = in->p;
-  zs.avail_in = stream_length(in) - stream_tell(in);
-  zs.next_out = out->data;
-  zs.avail_out = stream_size(out);
-  zs.zalloc = Z_NULL;
-  zs.zfree = Z_NULL;
-  zs.opaque = Z_NULL;
-
-  ret = inflateInit2(&zs, MAX_WBITS+16);
-  if (ret != Z_OK)
-  {
-    warning(TAG, "Failed to initialize inflate of stream with reason: %s", zs.msg);
+  uint32_t payload_size;
+  uint8_t gzip_header[3] = {0x1f, 0x8b, 0x08};
+  stream_t gzip, *out, view;
+  uint16_t src_port;
+  uint16_t dest_port;
+  uint8_t protocol;
+
+  payload_size = 0;
+  stream_in_uint32(stream, payload_size);
+
+  /* validate payload header */
+  if (payload_size < 10 || payload_size > stream->end - stream->p
+      || memcmp(stream->p, gzip_header, 3) != 0)
+  {
+    warning(TAG, "%s", "Payload header validation failed, skipping payload.");
     return;
   }
-  
-  /* decompress stream */
-  ret = inflate(&zs, Z_FINISH);
-  if (ret != Z_STREAM_END)
+
+  /* gzip stream view of payload, header is parsed once from message */
+  gzip = *stream;
+  gzip.end = gzip.p + payload_size;
+
+  /* skip gzip header and gzip flags */
+  stream_skip(stream, 3);
+  stream_skip(stream, 1);
+
+  /* read stream src and dest port */
+  stream_in_uint16(stream, src_port);
+  stream_in_uint16(stream, dest_port);
+
+  /* skip gzip xflags */
+  stream_skip(stream, 1);
+
+  /* read stream protocol */
+  stream_in_uint8(stream, protocol);
+
+  /* stored payloads are dispatched as view into receive buffer */
+  ret = 0;
+  if (self->recv_zero_copy)
+    ret = _client_payload_stored_view(&gzip, &view);
+
+  if (ret < 0)
   {
-    warning(TAG, "Failed to inflate of stream with reason %d: %s", ret, zs.msg);
-    inflateEnd(&zs);
+    warning(TAG, "%s", "Payload crc validation failed, skipping payload.");
     return;
   }
 
-  /* finalize the stream payload */
-  out->p += zs.total_out;
-  stream_mark_end(out);
+  if (ret > 0)
+    out = &view;
+  else
+  {
+    /* decompress payload into reused buffer */
+    out = inflate;
+    stream_reset(out);
+    if (i2cp_codec_decompress(codec, &gzip, out) != 0)
+      return;
+  }
+
+  /* dispatch uncompressed payload stream to session */
+  stream_seek_set(out, 0);
+  _session_dispatch_message(session, protocol, src_port, dest_port, out);
+}
+
+/* Copy payload out of the receive buffer */
+static _client_dispatch_item_t *
+_client_dispatch_item_new(struct i2cp_session_t *session, stream_t *stream)
+{
+  _client_dispatch_item_t *item;
+
+  item = malloc(sizeof(_client_dispatch_item_t) + (stream->end - stream->p));
+  item->next = NULL;
+  item->session = session;
+  item->length = stream->end - stream->p;
+  memcpy(item->data, stream->p, item->length);
+
+  return item;
+}
+
+/* Copy payload onto the ring of the thread which dispatches it, returns -1
+   if the ring is full */
+static int
+_client_dispatch_push(i2cp_client_t *self, struct spsc_t *ring,
+		      struct i2cp_session_t *session, stream_t *stream)
+{
+  _client_dispatch_item_t *item;
+
+  if (spsc_is_full(ring))
+    return -1;
+
+  item = _client_dispatch_item_new(session, stream);
+  if (spsc_push(ring, item) != 0)
+  {
+    free(item);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Park payload behind the ones already waiting for room on the ring of
+   worker, keeping the order of its sessions */
+static void
+_client_worker_park(_client_worker_t *worker, struct i2cp_session_t *session,
+		    stream_t *stream)
+{
+  _client_dispatch_item_t *item;
 
-  inflateEnd(&zs);
+  item = _client_dispatch_item_new(session, stream);
+  if (worker->parked_tail)
+    worker->parked_tail->next = item;
+  else
+    worker->parked_head = item;
+  worker->parked_tail = item;
+  worker->parked++;
 }
 
 static void
@@ -366,12 +953,8 @@ _client_on_msg_payload_message(i2cp_client_t *self, stream_t *stream, void *opaq
 {
   uint16_t session_id;
   uint32_t message_id;
-  uint8_t gzip_header[3] = {0x1f, 0x8b, 0x08};
-  stream_t out;
-  uint16_t src_port;
-  uint16_t dest_port;
-  uint8_t protocol;
   struct i2cp_session_t *session;
+  _client_worker_t *worker;
 
   debug(TAG|PROTOCOL, "%s", "Received PayloadMessage message.");
 
@@ -379,56 +962,35 @@ _client_on_msg_payload_message(i2cp_client_t *self, stream_t *stream, void *opaq
   stream_in_uint16(stream, session_id);
   stream_in_uint32(stream, message_id);
 
-  session = self->sessions[session_id];
+  session = _client_session_get(self, session_id);
   if (session == NULL)
     fatal(TAG|FATAL, "Session id %d does not match session client %p initiated.",
 	  session_id, (void *)self);
 
-  /* skip payload_size */
-  stream_skip(stream, 4);
-
-  /* validate payload header */
-  if (memcmp(stream->p, gzip_header, 3) != 0)
+  /* a worker behind on its ring must not hold back the sessions of the
+     other workers, so its payloads are parked while receive goes on */
+  if (self->worker_count)
   {
-    warning(TAG, "%s", "Payload header validation failed, skipping payload.");
+    worker = &self->workers[session_id % self->worker_count];
+    if (worker->parked == 0
+	&& _client_dispatch_push(self, worker->ring, session, stream) == 0)
+      worker->signal = 1;
+    else
+      _client_worker_park(worker, session, stream);
     return;
   }
 
-  /* setup zlib stream and decompress payload */
-  stream_init(&out, 0xffff);
-  _client_stream_inflate(stream, &out);
-
-  if (stream_length(&out) > 0)
+  if (self->dispatch != CLIENT_DISPATCH_CONSUMER)
   {
-    /* read streaming info out of gzip header */
-    stream_seek_set(stream, 0);
-
-    /* skip session_id, message_id, payload size */
-    stream_skip(stream, 2);
-    stream_skip(stream, 4);
-    stream_skip(stream, 4);
-
-    /* skip gzip header and gzip flags */
-    stream_skip(stream, 3);
-    stream_skip(stream, 1);
-
-    /* read stream src and dest port */
-    stream_in_uint16(stream, src_port);
-    stream_in_uint16(stream, dest_port);
-
-    /* skip gzip xflags */
-    stream_skip(stream, 1);
-
-    /* read stream protocol */
-    stream_in_uint8(stream, protocol);
+    _client_payload_dispatch(self, session, stream, self->codec, &self->inflate_stream);
+    return;
+  }
 
-    /* dispatch uncompressed payload stream to session */
-    stream_seek_set(&out, 0);
-    _session_dispatch_message(session, protocol, src_port, dest_port, &out);
+  /* receive stops before the ring fills, see _client_recv_blocked() */
+  if (_client_dispatch_push(self, self->dispatch_ring, session, stream) != 0)
+    fatal(TAG|FATAL, "%s", "Dispatch ring is full while receiving.");
 
-    /* cleanup */
-    stream_destroy(&out);
-  }
+  self->dispatch_signal = 1;
 }
 
 static void
@@ -439,6 +1001,7 @@ _client_on_msg_message_status(i2cp_client_t *self, stream_t *stream, void *opaqu
   uint8_t status;
   uint32_t size;
   uint32_t nonce;
+  struct i2cp_session_t *session;
 
   debug(TAG|PROTOCOL, "%s", "Received MessageStatus message.")
 
@@ -451,7 +1014,14 @@ _client_on_msg_message_status(i2cp_client_t *self, stream_t *stream, void *opaqu
   debug(TAG|PROTOCOL, "Message status; session id %d, message id %d, status %d, size %d, nonce %d",
 	session_id, message_id, status, size, nonce);
 
-  /* TODO: we do not support this due to fastReceive use */
+  session = _client_session_get(self, session_id);
+  if (session == NULL)
+  {
+    warning(TAG, "Message status for unknown session id %d.", session_id);
+    return;
+  }
+
+  _session_dispatch_message_status(session, message_id, status, size, nonce);
 }
 
 static void
@@ -489,11 +1059,13 @@ _client_on_msg_dest_reply(i2cp_client_t *self, stream_t *stream, void *opaque)
   }
 
   /* lookup destination lookup request for dispatch of the results */
+  pthread_mutex_lock(&self->lookup_lock);
   request_id = (uint32_t)stringmap_get(self->lookups, (const char *)b32.data);
   stringmap_remove(self->lookups, (const char *)b32.data);
 
   lup = (_client_host_lookup_item_t *)intmap_get(self->lookup_requests, request_id);
   intmap_remove(self->lookup_requests, request_id);
+  pthread_mutex_unlock(&self->lookup_lock);
 
   if (lup == NULL)
   {
@@ -535,13 +1107,23 @@ _client_on_msg_host_reply(i2cp_client_t *self, stream_t *stream, void *opaque)
   if (result == 0 && destination == NULL)
     fatal(TAG|FATAL, "%s", "Failed to construct destination from stream.");
 
-  session = self->sessions[session_id];
+  session = _client_session_get(self, session_id);
   if (session == NULL)
     fatal(TAG|FATAL, "Session with id %d doesn't exists in client instance %p.",
 		session_id, (void *)self);
 
+  pthread_mutex_lock(&self->lookup_lock);
   lup = (_client_host_lookup_item_t *)intmap_get(self->lookup_requests, request_id);
-  intmap_remove(self->lookup_requests, lup);
+  intmap_remove(self->lookup_requests, request_id);
+  pthread_mutex_unlock(&self->lookup_lock);
+
+  if (lup == NULL)
+  {
+    warning(TAG, "No lookup request with id %d.", request_id);
+    if (destination)
+      i2cp_destination_destroy(destination);
+    return;
+  }
 
   _session_dispatch_destination(session, request_id, lup->address, destination);
 
@@ -552,7 +1134,30 @@ _client_on_msg_host_reply(i2cp_client_t *self, stream_t *stream, void *opaque)
 static void
 _client_on_msg_bandwidth_limits(i2cp_client_t *self, stream_t *stream, void *opaque)
 {
+  i2cp_bandwidth_limits_t *bw;
+
   debug(TAG|PROTOCOL, "%s", "Received BandwidthLimits message.");
+
+  /* seven limits followed by nine undefined */
+  bw = &self->bandwidth_limits;
+  pthread_mutex_lock(&self->output_lock);
+  stream_in_uint32(stream, bw->client_inbound);
+  stream_in_uint32(stream, bw->client_outbound);
+  stream_in_uint32(stream, bw->router_inbound);
+  stream_in_uint32(stream, bw->router_inbound_burst);
+  stream_in_uint32(stream, bw->router_outbound);
+  stream_in_uint32(stream, bw->router_outbound_burst);
+  stream_in_uint32(stream, bw->router_burst_time);
+  self->has_bandwidth_limits = 1;
+  _client_shaper_update(self);
+  pthread_mutex_unlock(&self->output_lock);
+
+  debug(TAG, "Bandwidth limits; client in %u out %u KBps, router in %u/%u out %u/%u KBps burst %u s",
+	bw->client_inbound, bw->client_outbound, bw->router_inbound, bw->router_inbound_burst,
+	bw->router_outbound, bw->router_outbound_burst, bw->router_burst_time);
+
+  if (self->callbacks && self->callbacks->on_bandwidth_limits)
+    self->callbacks->on_bandwidth_limits(self, bw, self->callbacks->opaque);
 }
 
 static void
@@ -568,20 +1173,36 @@ _client_on_msg_session_status(i2cp_client_t *self, stream_t *stream, void *opaqu
   stream_in_uint16(stream, session_id);
   stream_in_uint8(stream, session_status);
 
-  /* if session is created lets assign session instance to session_id */
-  if (session_status == I2CP_SESSION_STATUS_CREATED)
+  session = _client_session_get(self, session_id);
+
+  /* status of an unknown session id is the router response to the oldest
+     CreateSession, if session is created lets assign session instance to
+     session_id */
+  if (session == NULL && self->pending_sessions_sent > 0)
   {
-    _i2cp_session_set_id((struct i2cp_sessiont_t *)opaque, session_id);
-    self->sessions[session_id] = (struct i2cp_session_t *)opaque;
+    session = self->pending_sessions[0];
+    self->pending_session_count--;
+    self->pending_sessions_sent--;
+    memmove(&self->pending_sessions[0], &self->pending_sessions[1],
+	    self->pending_session_count * sizeof(struct i2cp_session_t *));
+
+    if (session_status == I2CP_SESSION_STATUS_CREATED)
+    {
+      _i2cp_session_set_id(session, session_id);
+      _client_session_add(self, session_id, session);
+    }
   }
 
-  session = self->sessions[session_id];
-
   if (session == NULL)
     fatal(TAG|FATAL, "Session with id %d doesn't exists in client instance %p.",
 		session_id, (void *)self);
 
   _session_dispatch_session_status(session, session_status);
+  _client_dispatch_on_session_status(self, session, session_status);
+
+  if (session_status == I2CP_SESSION_STATUS_DESTROYED
+      && _client_session_get(self, session_id) == session)
+    _client_session_remove(self, session_id);
 }
 
 static void
@@ -600,7 +1221,7 @@ _client_on_msg_request_variable_leaseset(i2cp_client_t *self, stream_t *stream,
   stream_in_uint8(stream, tunnels);
 
   /* get session for the request */
-  session = self->sessions[session_id];
+  session = _client_session_get(self, session_id);
   if (session == NULL)
     fatal(TAG|FATAL, "Session with id %d doesn't exists in client instance %p.",
 		session_id, (void *)self);
@@ -619,163 +1240,543 @@ _client_on_msg_request_variable_leaseset(i2cp_client_t *self, stream_t *stream,
 
 }
 
+/* Built-in message handlers indexed by message type, these are installed
+   in the handler table of each client and restored when an application
+   handler is unregistered. */
+static const i2cp_client_message_handler_t _client_default_handlers[I2CP_MSG_TYPES] = {
+  [I2CP_MSG_SET_DATE] = _client_on_msg_set_date,
+  [I2CP_MSG_DISCONNECT] = _client_on_msg_disconnect,
+  [I2CP_MSG_PAYLOAD_MESSAGE] = _client_on_msg_payload_message,
+  [I2CP_MSG_MESSAGE_STATUS] = _client_on_msg_message_status,
+  [I2CP_MSG_DEST_REPLY] = _client_on_msg_dest_reply,
+  [I2CP_MSG_BANDWIDTH_LIMITS] = _client_on_msg_bandwidth_limits,
+  [I2CP_MSG_SESSION_STATUS] = _client_on_msg_session_status,
+  [I2CP_MSG_REQUEST_VARIABLE_LEASESET] = _client_on_msg_request_variable_leaseset,
+  [I2CP_MSG_HOST_REPLY] = _client_on_msg_host_reply,
+};
+
 static void
-_client_on_msg(i2cp_client_t *self, uint8_t type, stream_t *stream, void *opaque)
+_client_on_msg(i2cp_client_t *self, uint8_t type, stream_t *stream)
 {
-  /* TODO: rewrite for performance, static array with func pointers index by type */
-  switch (type)
+  _client_message_handler_t *handler;
+
+  handler = &self->handlers[type];
+  if (handler->fn == NULL)
   {
-  case I2CP_MSG_SET_DATE:
-    _client_on_msg_set_date(self, stream, opaque);
-    break;
+    info(TAG, "recieved unhandled i2cp message type %d.", type);
+    return;
+  }
 
-  case I2CP_MSG_DISCONNECT:
-    _client_on_msg_disconnect(self, stream, opaque);
-    break;
+  handler->fn(self, stream, handler->opaque);
+}
 
-  case I2CP_MSG_PAYLOAD_MESSAGE:
-    _client_on_msg_payload_message(self, stream, opaque);
-    break;
+/* Create an event signaled through write descriptor fds[1] and polled on
+   read descriptor fds[0], both are the same eventfd where available */
+static int
+_client_event_init(int fds[2])
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return fds[0] < 0 ? -1 : 0;
+#else
+  if (pipe(fds) < 0)
+  {
+    fds[0] = fds[1] = -1;
+    return -1;
+  }
 
-  case I2CP_MSG_MESSAGE_STATUS:
-    _client_on_msg_message_status(self, stream, opaque);
-    break;
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return 0;
+#endif
+}
 
-  case I2CP_MSG_DEST_REPLY:
-    _client_on_msg_dest_reply(self, stream, opaque);
-    break;
+static void
+_client_event_destroy(int fds[2])
+{
+  if (fds[1] >= 0 && fds[1] != fds[0])
+    close(fds[1]);
+  if (fds[0] >= 0)
+    close(fds[0]);
 
-  case I2CP_MSG_BANDWIDTH_LIMITS:
-    _client_on_msg_bandwidth_limits(self, stream, opaque);
-    break;
+  fds[0] = fds[1] = -1;
+}
 
-  case I2CP_MSG_SESSION_STATUS:
-    _client_on_msg_session_status(self, stream, opaque);
-    break;
+static void
+_client_event_signal(int fds[2])
+{
+  uint64_t one = 1;
 
-  case I2CP_MSG_REQUEST_VARIABLE_LEASESET:
-    _client_on_msg_request_variable_leaseset(self, stream, opaque);
-    break;
+  /* a full pipe or counter is still signaled */
+  if (write(fds[1], &one, sizeof(one)) < 0 && errno != EAGAIN)
+    error(TAG, "failed to signal event with reason: %s", strerror(errno));
+}
 
-  case I2CP_MSG_HOST_REPLY:
-    _client_on_msg_host_reply(self, stream, opaque);
-    break;
+static void
+_client_event_clear(int fds[2])
+{
+  uint64_t buf[8];
 
-  default:
-    info(TAG, "%s", "recieved unhandled i2cp message.");
-    break;
-  }
+  while (read(fds[0], buf, sizeof(buf)) > 0)
+    continue;
 }
 
-/* TODO: This needs to be rewritten so that recv buffer is drained in chunks and multiple
-         messages are processed and dispatched.
- */
-static int
-_client_recv_msg(i2cp_client_t *self, uint8_t type, stream_t *stream, int dispatch, void *opaque)
+/* Wake the io thread to send queued messages, the event is signaled once
+   until the io thread has woken up */
+static void
+_client_io_wake(i2cp_client_t *self)
 {
-  int ret;
-  uint32_t length;
-  uint8_t msg_type;
+  if (self->io_wake[1] < 0)
+    return;
 
-  stream_reset(stream);
+  if (!atomic_exchange(&self->io_wake_pending, 1))
+    _client_event_signal(self->io_wake);
+}
+
+/* The io thread has woken up, the event is cleared before the pending flag
+   so a sender which found the flag clear signals after the clear */
+static void
+_client_io_woken(i2cp_client_t *self)
+{
+  _client_event_clear(self->io_wake);
+  atomic_store(&self->io_wake_pending, 0);
+}
+
+/* Move parked payloads onto the ring of worker as far as it has room */
+static void
+_client_worker_unpark(_client_worker_t *worker)
+{
+  int cnt;
+  _client_dispatch_item_t *item;
+
+  /* the worker may free an item as soon as it is pushed, so it is unlinked
+     before */
+  cnt = 0;
+  while ((item = worker->parked_head) != NULL && !spsc_is_full(worker->ring))
+  {
+    worker->parked_head = item->next;
+    if (worker->parked_head == NULL)
+      worker->parked_tail = NULL;
+    worker->parked--;
+    spsc_push(worker->ring, item);
+    cnt++;
+  }
+
+  if (cnt)
+    _client_event_signal(worker->wake);
+}
 
-  length = msg_type = 0;
+/* Check if receiving is stopped as the consumer hasn't drained the dispatch
+   ring, or a worker has too many payloads parked. The blocked flag is set
+   before checking again since the consumer or a worker may have drained
+   its ring in between. */
+static int
+_client_recv_full(i2cp_client_t *self)
+{
+  int i, parked;
+
+  if (self->worker_count == 0)
+    return self->dispatch == CLIENT_DISPATCH_CONSUMER && spsc_is_full(self->dispatch_ring);
+
+  /* the most payloads parked for a worker, while non zero the workers
+     wake the thread running io to move them onto their ring */
+  parked = 0;
+  for (i = 0; i < self->worker_count; i++)
+  {
+    _client_worker_unpark(&self->workers[i]);
+    if (self->workers[i].parked > parked)
+      parked = self->workers[i].parked;
+  }
+
+  return parked;
+}
+
+static int
+_client_recv_blocked(i2cp_client_t *self)
+{
+  if (!_client_recv_full(self))
+    return 0;
+
+  atomic_store(&self->dispatch_blocked, 1);
+  if (self->worker_count)
+    return _client_recv_full(self) >= I2CP_DISPATCH_PARK_LIMIT;
+
+  return _client_recv_full(self);
+}
+
+/* Fill the receive buffer with as much as the socket has to offer in one non
+   blocking read. Unframed data is moved to the front of the buffer before
+   reading. Returns -1 with errno EAGAIN if there was nothing to read.
+ */
+static int
+_client_recv_fill(i2cp_client_t *self)
+{
+  int ret;
+  size_t pending;
+  stream_t *in;
+
+  in = &self->input_stream;
+  pending = in->end - in->p;
+
+  /* compact partial message to begin of buffer */
+  if (in->p != in->data)
+  {
+    memmove(in->data, in->p, pending);
+    stream_reset(in);
+    in->end = in->data + pending;
+  }
+
+  /* read into the free tail of buffer */
+  stream_seek_set(in, pending);
+  ret = tcp_recv_nonblock(self->tcp, in, stream_size(in) - pending);
+  stream_mark_end(in);
+  stream_seek_set(in, 0);
 
-  /* recv i2cp message header into stream */
-  ret = tcp_recv(self->tcp, stream, 5);
   if (ret == 0)
+  {
+    self->state = I2CP_CLIENT_STATE_DISCONNECTED;
     _client_dispatch_on_disconnect(self, "Peer shutdown the connection.");
-    
+  }
 
-  if (ret != 5)
-    error(TAG|PROTOCOL, "failed to receive header with reason: %s", strerror(errno));
+  if (ret < 0 && errno != EAGAIN)
+    error(TAG|PROTOCOL, "failed to receive data with reason: %s", strerror(errno));
+
+  return ret;
+}
+
+/* Frame the next complete message in receive buffer, the message body is
+   returned as a view into the receive buffer which is valid until next fill.
+   Returns 1 if a message was framed, 0 if more data is needed and -1 on
+   invalid message length.
+ */
+static int
+_client_recv_frame(i2cp_client_t *self, uint8_t *type, stream_t *body)
+{
+  uint32_t length;
+  stream_t header;
+  stream_t *in;
+
+  in = &self->input_stream;
+  if (in->end - in->p < 5)
+    return 0;
 
   /* parse header */
-  stream_seek_set(stream, 0);
-  stream_in_uint32(stream, length);
-  stream_in_uint8(stream, msg_type);
+  header = *in;
+  stream_in_uint32(&header, length);
+  stream_in_uint8(&header, *type);
+
+  /* Abort on unexpected message lengths */
+  if (length > I2CP_MESSAGE_SIZE)
+    return -1;
+
+  if (in->end - header.p < length)
+    return 0;
+
+  /* setup view of message body and consume the message */
+  body->data = body->p = header.p;
+  body->size = length;
+  body->end = body->data + length;
+  in->p = body->end;
+
+  return 1;
+}
+
+/* Dispatch all complete messages in receive buffer */
+static int
+_client_recv_dispatch(i2cp_client_t *self)
+{
+  int i, ret, cnt;
+  uint8_t msg_type;
+  stream_t body;
+
+  cnt = ret = 0;
+  while (!_client_recv_blocked(self) && (ret = _client_recv_frame(self, &msg_type, &body)) > 0)
+  {
+    _client_on_msg(self, msg_type, &body);
+    cnt++;
+  }
+
+  /* wake consumer and workers for the payloads pushed to their ring */
+  if (self->dispatch_signal)
+  {
+    self->dispatch_signal = 0;
+    _client_event_signal(self->dispatch_wake);
+  }
+
+  for (i = 0; i < self->worker_count; i++)
+  {
+    if (self->workers[i].signal)
+    {
+      self->workers[i].signal = 0;
+      _client_event_signal(self->workers[i].wake);
+    }
+  }
 
   /* Detect SSL connection */
-  if (type == I2CP_MSG_SET_DATE && length > 0xffff)
+  if (ret < 0 && self->state == I2CP_CLIENT_STATE_AWAIT_SETDATE)
     fatal(TAG|PROTOCOL, "unexpected response, your router is probably configured to use SSL.");
 
-  /* Abort on unexpected message lengths */
-  if (length > 0xffff)
+  if (ret < 0)
     fatal(TAG|PROTOCOL, "unexpected message length, length > 0xffff");
 
-  /* Is message of expected type */
-  if (type && msg_type != type)
-    error(TAG|PROTOCOL, "expected message type %d, received %d", type, msg_type);
+  return cnt;
+}
+
+/* Reserve space for len bytes at end of output queue and setup a stream
+   view for serializing into the reserved space. Must be called with the
+   output lock held.
+ */
+static void
+_client_output_reserve(i2cp_client_t *self, stream_t *view, size_t len)
+{
+  size_t pending, size;
+  stream_t *out;
 
-  /* read the message body into begin of stream */
-  stream_seek_set(stream, 0);
-  ret = tcp_recv(self->tcp, stream, length);
-  if (ret != length)
-    error(TAG|PROTOCOL, "failed to receive %d bytes of data", length);
+  out = &self->output_stream;
+  pending = out->end - out->p;
 
-  /* mark end and reposition stream pointer to the actual message payload */
-  stream_mark_end(stream);
-  stream_seek_set(stream, 0);
- 
-   
-  /* dispatch received message to handlers */
-  if (dispatch)
-    _client_on_msg(self, msg_type, stream, opaque);
+  if (out->end + len > out->data + stream_size(out))
+  {
+    /* compact queued messages to begin of buffer */
+    memmove(out->data, out->p, pending);
+    stream_reset(out);
+    out->end = out->data + pending;
+
+    /* grow buffer if still not fitting */
+    if (pending + len > stream_size(out))
+    {
+      size = stream_size(out);
+      while (pending + len > size)
+	size *= 2;
+
+      debug(TAG, "Growing output queue to %ld bytes.", size);
+      out->data = realloc(out->data, size);
+      out->size = size;
+      out->p = out->data;
+      out->end = out->data + pending;
+    }
+  }
 
-  return ret;
+  view->data = view->p = view->end = out->end;
+  view->size = len;
 }
 
-/* Send a message, puts message on output queue if instructed wither a send is carried out
-   syncronously
+/* Move messages on the send queue to end of output queue, or discard them
+   if drop is set. Must be called with the output lock held.
  */
+static void
+_client_send_queue_drain(i2cp_client_t *self, int drop)
+{
+  stream_t view;
+  _client_send_node_t *node;
+
+  while ((node = (_client_send_node_t *)mpsc_pop(&self->send_queue)) != NULL)
+  {
+    atomic_fetch_sub(&self->send_queue_bytes, node->length);
+    if (!drop)
+    {
+      _client_output_reserve(self, &view, node->length);
+      memcpy(view.p, node->data, node->length);
+      self->output_stream.end = view.p + node->length;
+    }
+    free(node);
+  }
+}
+
+/* Send a vector blocking until all of it is written, resuming partial writes */
 static int
-_client_send_msg(i2cp_client_t *self, uint8_t type, stream_t *stream, int queue)
+_client_sendv_all(i2cp_client_t *self, struct iovec *iov, int iovcnt)
 {
-  int ret;
-  stream_t *s;
+  int ret, total;
 
-  ret = 0;
-  s = malloc(sizeof(stream_t));
-  stream_init(s, stream_length(stream) + 4 + 1);
+  total = 0;
+  while (iovcnt > 0)
+  {
+    ret = tcp_sendv(self->tcp, iov, iovcnt, 0);
+    if (ret < 0)
+      return ret;
 
-  /* write i2cp message header */
-  stream_out_uint32(s, stream_length(stream));
-  stream_out_uint8(s, type);
+    total += ret;
+
+    /* skip what was written */
+    while (iovcnt > 0 && ret >= iov->iov_len)
+    {
+      ret -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (uint8_t *)iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+
+  return total;
+}
 
-  /* write the actual message */
-  stream_out_stream(s, stream);
+/* Bytes on output queue and send queue */
+static size_t
+_client_output_queued(i2cp_client_t *self)
+{
+  return (self->output_stream.end - self->output_stream.p)
+    + atomic_load(&self->send_queue_bytes);
+}
+
+/* Notify application when output queue crosses the high water mark and when
+   it has drained to half of it again. Called with the output lock held, the
+   event is dispatched after the lock is released.
+ */
+static int
+_client_output_check_water(i2cp_client_t *self)
+{
+  size_t queued;
 
-  stream_mark_end(s);
+  if (self->send_high_water == 0)
+    return -1;
 
-  if (queue)
+  queued = _client_output_queued(self);
+  if (!self->send_above_water && queued > self->send_high_water)
+    return (self->send_above_water = 1);
+
+  if (self->send_above_water && queued <= self->send_high_water / 2)
+    return (self->send_above_water = 0);
+
+  return -1;
+}
+
+static void
+_client_dispatch_on_backpressure(i2cp_client_t *self, int above)
+{
+  size_t queued;
+
+  if (above < 0 || self->callbacks == NULL || self->callbacks->on_backpressure == NULL)
+    return;
+
+  pthread_mutex_lock(&self->output_lock);
+  queued = _client_output_queued(self);
+  pthread_mutex_unlock(&self->output_lock);
+
+  self->callbacks->on_backpressure(self, queued, above, self->callbacks->opaque);
+}
+
+/* Send a message built from a vector of buffers, puts message on output queue if
+   instructed wither the header and vector is sent syncronously in one gathered write.
+ */
+static int
+_client_send_msgv(i2cp_client_t *self, uint8_t type, const struct iovec *iov, int iovcnt, int queue)
+{
+  int i, ret, water;
+  uint32_t length;
+  uint8_t header[5];
+  stream_t view, hs;
+  struct iovec vec[8];
+  _client_send_node_t *node;
+
+  length = 0;
+  for (i = 0; i < iovcnt; i++)
+    length += iov[i].iov_len;
+
+  /* write i2cp message header */
+  hs.data = hs.p = hs.end = header;
+  hs.size = sizeof(header);
+  stream_out_uint32(&hs, length);
+  stream_out_uint8(&hs, type);
+
+  /* serialize message in place at end of output queue unless another
+     thread holds the output lock, messages on the send queue go first to
+     keep the order of a sending thread */
+  if (queue && pthread_mutex_trylock(&self->output_lock) == 0)
   {
-    debug(TAG|PROTOCOL, "Putting %d bytes message on output queue.", stream_length(s)); 
-    /* put message on output queue */
-    queue_lock(self->output_queue);
-    queue_push(self->output_queue, s);
-    queue_unlock(self->output_queue);
-    ret = stream_length(s);
+    if (mpsc_is_empty(&self->send_queue))
+    {
+      _client_output_reserve(self, &view, length + 4 + 1);
+      stream_out_uint8p(&view, header, sizeof(header));
+      for (i = 0; i < iovcnt; i++)
+	stream_out_uint8p(&view, iov[i].iov_base, iov[i].iov_len);
+      stream_mark_end(&view);
+
+      debug(TAG|PROTOCOL, "Putting %d bytes message on output queue.", stream_length(&view));
+      self->output_stream.end = view.end;
+      water = _client_output_check_water(self);
+      pthread_mutex_unlock(&self->output_lock);
+
+      _client_io_wake(self);
+      _client_dispatch_on_backpressure(self, water);
+      return stream_length(&view);
+    }
+    pthread_mutex_unlock(&self->output_lock);
   }
-  else
+
+  /* frame message into a node of the send queue without taking a lock */
+  if (queue)
   {
-    /* send the message directly */
-    ret = tcp_send(self->tcp, s);
-    stream_destroy(s);
-    free(s);
+    node = malloc(sizeof(_client_send_node_t) + length + 4 + 1);
+    view.data = view.p = view.end = node->data;
+    view.size = length + 4 + 1;
+    stream_out_uint8p(&view, header, sizeof(header));
+    for (i = 0; i < iovcnt; i++)
+      stream_out_uint8p(&view, iov[i].iov_base, iov[i].iov_len);
+    stream_mark_end(&view);
+
+    debug(TAG|PROTOCOL, "Putting %d bytes message on send queue.", stream_length(&view));
+    /* node is owned by the consumer once pushed, its bytes are counted
+       before so the consumer never subtracts them first */
+    ret = node->length = stream_length(&view);
+    atomic_fetch_add(&self->send_queue_bytes, ret);
+    mpsc_push(&self->send_queue, &node->node);
+    _client_io_wake(self);
+
+    /* check high water unless the lock is taken, its holder or the next
+       flush checks it then */
+    if (self->send_high_water && pthread_mutex_trylock(&self->output_lock) == 0)
+    {
+      water = _client_output_check_water(self);
+      pthread_mutex_unlock(&self->output_lock);
+      _client_dispatch_on_backpressure(self, water);
+    }
+    return ret;
   }
 
+  /* send header and message vector directly */
+  if (iovcnt + 1 > sizeof(vec) / sizeof(vec[0]))
+    fatal(TAG, "Too many vectors (%d) for message.", iovcnt);
+
+  vec[0].iov_base = header;
+  vec[0].iov_len = sizeof(header);
+  memcpy(&vec[1], iov, iovcnt * sizeof(struct iovec));
+
+  ret = _client_sendv_all(self, vec, iovcnt + 1);
   return ret;
 }
 
+/* Send a message, puts message on output queue if instructed wither a send is carried out
+   syncronously
+ */
+static int
+_client_send_msg(i2cp_client_t *self, uint8_t type, stream_t *stream, int queue)
+{
+  struct iovec iov;
+
+  iov.iov_base = stream->data;
+  iov.iov_len = stream_length(stream);
+
+  return _client_send_msgv(self, type, &iov, 1, queue);
+}
+
 static void
 _client_msg_get_date(i2cp_client_t *self, int queue)
 {
   int ret;
-  stream_t auth;
+  stream_t auth, *stream;
 
   debug(TAG|PROTOCOL, "%s", "Sending GetDateMessage.");
-  stream_reset(&self->message_stream);
-  stream_out_string(&self->message_stream, I2CP_CLIENT_VERSION, sizeof(I2CP_CLIENT_VERSION) - 1);
+  stream = &_client_send_scratch()->message_stream;
+  stream_reset(stream);
+  stream_out_string(stream, I2CP_CLIENT_VERSION, sizeof(I2CP_CLIENT_VERSION) - 1);
 
   /* write new 0.9.10 auth mapping if username property is set */
   if (self->properties[CLIENT_PROP_USERNAME])
@@ -793,14 +1794,14 @@ _client_msg_get_date(i2cp_client_t *self, int queue)
     stream_out_uint8(&auth, ';');
     stream_mark_end(&auth);
 
-    stream_out_uint16(&self->message_stream, stream_length(&auth));
-    stream_out_stream(&self->message_stream, &auth);
+    stream_out_uint16(stream, stream_length(&auth));
+    stream_out_stream(stream, &auth);
 
     stream_destroy(&auth);
   }
 
-  stream_mark_end(&self->message_stream);
-  ret = _client_send_msg(self, I2CP_MSG_GET_DATE, &self->message_stream, queue);
+  stream_mark_end(stream);
+  ret = _client_send_msg(self, I2CP_MSG_GET_DATE, stream, queue);
   if (ret <= 0)
     error(TAG, "%s", "error while sending GetDateMessage.");
   
@@ -810,12 +1811,14 @@ static void
 _client_msg_create_session(i2cp_client_t *self, struct i2cp_session_config_t *config, int queue)
 {
   int ret;
+  stream_t *stream;
   debug(TAG|PROTOCOL, "%s", "Sending CreateSessionMessage.");
-  stream_reset(&self->message_stream);
-  i2cp_session_config_get_message(config, &self->message_stream);
-  stream_mark_end(&self->message_stream);
+  stream = &_client_send_scratch()->message_stream;
+  stream_reset(stream);
+  i2cp_session_config_get_message(config, stream);
+  stream_mark_end(stream);
 
-  ret = _client_send_msg(self, I2CP_MSG_CREATE_SESSION, &self->message_stream, queue);
+  ret = _client_send_msg(self, I2CP_MSG_CREATE_SESSION, stream, queue);
   if (ret <= 0)
     error(TAG, "%s", "error while sending CreateSessionMessage.");
   
@@ -827,7 +1830,7 @@ _client_msg_create_lease_set(i2cp_client_t *self, struct i2cp_session_t *session
 {
   int ret, t;
   uint8_t nullbytes[256];
-  stream_t leaseset;
+  stream_t leaseset, *stream;
   struct i2cp_session_config_t *session_cfg;
   struct i2cp_destination_t *session_destination;
   const i2cp_signature_keypair_t *signature_keys;
@@ -835,7 +1838,8 @@ _client_msg_create_lease_set(i2cp_client_t *self, struct i2cp_session_t *session
   debug(TAG|PROTOCOL, "%s", "Sending CreateLeaseSetMessage");
 
   stream_init(&leaseset, 4096);
-  stream_reset(&self->message_stream);
+  stream = &_client_send_scratch()->message_stream;
+  stream_reset(stream);
 
   /* get the instance */
   session_cfg = i2cp_session_get_config(session);
@@ -845,9 +1849,9 @@ _client_msg_create_lease_set(i2cp_client_t *self, struct i2cp_session_t *session
   memset(nullbytes, 0, sizeof(nullbytes));
 
   /* construct the message */
-  stream_out_uint16(&self->message_stream, i2cp_session_get_id(session));
-  stream_out_uint8p(&self->message_stream, nullbytes, 20);
-  stream_out_uint8p(&self->message_stream, nullbytes, 256);
+  stream_out_uint16(stream, i2cp_session_get_id(session));
+  stream_out_uint8p(stream, nullbytes, 20);
+  stream_out_uint8p(stream, nullbytes, 256);
 
   /* build lease set stream and sign it */
   i2cp_destination_get_message(session_destination, &leaseset);
@@ -863,12 +1867,12 @@ _client_msg_create_lease_set(i2cp_client_t *self, struct i2cp_session_t *session
   i2cp_crypto_sign_stream(i2cp_crypto_instance(), signature_keys, &leaseset);
   
   /* write signed leasset stream into message */
-  stream_out_stream(&self->message_stream, &leaseset);
+  stream_out_stream(stream, &leaseset);
 
-  stream_mark_end(&self->message_stream);
+  stream_mark_end(stream);
 
   /* send the message */
-  ret = _client_send_msg(self, I2CP_MSG_CREATE_LEASE_SET, &self->message_stream, queue);
+  ret = _client_send_msg(self, I2CP_MSG_CREATE_LEASE_SET, stream, queue);
   if (ret <= 0)
     error(TAG, "%s", "error while sending CreateSessionMessage.");
 }
@@ -877,13 +1881,15 @@ static void
 _client_msg_dest_lookup(i2cp_client_t *self, uint8_t *hash, int queue)
 {
   int ret;
+  stream_t *stream;
   debug(TAG|PROTOCOL, "%s", "Sending DestLookupMessage."); 
-  stream_reset(&self->message_stream);
+  stream = &_client_send_scratch()->message_stream;
+  stream_reset(stream);
   
-  stream_out_uint8p(&self->message_stream, hash, 32);
-  stream_mark_end(&self->message_stream);
+  stream_out_uint8p(stream, hash, 32);
+  stream_mark_end(stream);
 
-  ret = _client_send_msg(self, I2CP_MSG_DEST_LOOKUP, &self->message_stream, queue);
+  ret = _client_send_msg(self, I2CP_MSG_DEST_LOOKUP, stream, queue);
   if (ret <= 0)
     error(TAG, "%s", "error while sending DestLookupMessage.");
 }
@@ -894,30 +1900,32 @@ _client_msg_host_lookup(i2cp_client_t *self, struct i2cp_session_t *session,
 			int type, void *data, size_t len, int queue)
 {
   int ret;
+  stream_t *stream;
   uint16_t session_id;
 
   debug(TAG|PROTOCOL, "%s", "Sending HostLookupMessage.");
-  stream_reset(&self->message_stream);
+  stream = &_client_send_scratch()->message_stream;
+  stream_reset(stream);
 
   session_id = i2cp_session_get_id(session);
 
-  stream_out_uint16(&self->message_stream, session_id);
-  stream_out_uint32(&self->message_stream, request_id);
-  stream_out_uint32(&self->message_stream, timeout);
-  stream_out_uint8(&self->message_stream, type);
+  stream_out_uint16(stream, session_id);
+  stream_out_uint32(stream, request_id);
+  stream_out_uint32(stream, timeout);
+  stream_out_uint8(stream, type);
 
   if (type == HOST_LOOKUP_TYPE_HASH)
   {
-    stream_out_uint8p(&self->message_stream, data, len);
+    stream_out_uint8p(stream, data, len);
   }
   else
   {
-    stream_out_string(&self->message_stream, (char*)data, strlen(data));
+    stream_out_string(stream, (char*)data, strlen(data));
   }
 
-  stream_mark_end(&self->message_stream);
+  stream_mark_end(stream);
 
-  ret = _client_send_msg(self, I2CP_MSG_HOST_LOOKUP, &self->message_stream, queue);
+  ret = _client_send_msg(self, I2CP_MSG_HOST_LOOKUP, stream, queue);
   if (ret <= 0)
     error(TAG, "%s", "error while sending HostLookupMessage.");
 }
@@ -927,16 +1935,18 @@ static void
 _client_msg_destroy_session(i2cp_client_t *self, struct i2cp_session_t *session, int queue)
 {
   int ret;
+  stream_t *stream;
   uint16_t session_id;
   debug(TAG|PROTOCOL, "%s", "Sending DestroySessionMessage.");
-  stream_reset(&self->message_stream);
+  stream = &_client_send_scratch()->message_stream;
+  stream_reset(stream);
 
   session_id = i2cp_session_get_id(session);
   
-  stream_out_uint16(&self->message_stream, session_id);
-  stream_mark_end(&self->message_stream);
+  stream_out_uint16(stream, session_id);
+  stream_mark_end(stream);
 
-  ret = _client_send_msg(self, I2CP_MSG_DESTROY_SESSION, &self->message_stream, queue);
+  ret = _client_send_msg(self, I2CP_MSG_DESTROY_SESSION, stream, queue);
   if (ret <= 0)
     error(TAG, "%s", "error while sending DestroySessionMessage.");
 }
@@ -945,69 +1955,197 @@ static void
 _client_msg_get_bandwidth_limits(i2cp_client_t *self, int queue)
 {
   int ret;
+  stream_t *stream;
+
   debug(TAG|PROTOCOL, "%s", "Sending GetBandwidthLimitsMessage.");
-  stream_reset(&self->message_stream);
+  stream = &_client_send_scratch()->message_stream;
+  stream_reset(stream);
 
-  ret = _client_send_msg(self, I2CP_MSG_GET_BANDWIDTH_LIMITS, &self->message_stream, queue);
+  ret = _client_send_msg(self, I2CP_MSG_GET_BANDWIDTH_LIMITS, stream, queue);
   if (ret <= 0)
     error(TAG, "%s", "error while sending GetBandwidthLimitsMessage.");
 }
 
 /* Keep non static dues to internal i2cp lib access from session.c */
-void
+int
 _client_msg_send_message(i2cp_client_t *self, struct i2cp_session_t *session,
 			 struct i2cp_destination_t *destination,
 			 i2cp_protocol_t protocol, uint16_t src_port, uint16_t dest_port,
-			 stream_t *payload, uint32_t nonce, int queue)
+			 stream_t *payload, uint32_t nonce,
+			 const i2cp_send_options_t *options, int queue)
 {
-  int ret;
-  stream_t in, out;
-
-  debug(TAG|PROTOCOL, "%s", "Sending SendMessageMessage.");
-  stream_reset(&self->message_stream);
-
-  /* write packet */
-  stream_out_uint16(&self->message_stream, i2cp_session_get_id(session));
-  i2cp_destination_get_message(destination, &self->message_stream);
-
-  /* deflate payload and write to stream */
-  stream_init(&in, 0xffff);
-  stream_init(&out, 0xffff);
+  int ret, level, policy;
+  uint8_t type, head[2], size[4], trailer[12];
+  uint64_t expiration;
+  size_t dest_length;
+  const uint8_t *dest;
+  stream_t *out, ts, hs;
+  struct iovec iov[5];
+  struct timeval tp;
+  _client_send_scratch_t *scratch;
+  _client_compression_ratio_t *entry;
+
+  /* send options require SendMessageExpires, fall back to SendMessage
+     for routers not supporting it */
+  type = I2CP_MSG_SEND_MESSAGE;
+  if (options && (self->router.capabilities & ROUTER_CAN_SEND_MESSAGE_EXPIRES))
+    type = I2CP_MSG_SEND_MESSAGE_EXPIRES;
+  else if (options)
+    debug(TAG, "%s", "Router does not support SendMessageExpires, ignoring send options.");
+
+  debug(TAG|PROTOCOL, "Sending %s.", type == I2CP_MSG_SEND_MESSAGE
+	? "SendMessageMessage" : "SendMessageExpiresMessage");
+
+  /* compress in scratch of the calling thread, so senders on several
+     threads run in parallel up to the enqueue */
+  scratch = _client_send_scratch();
+
+  /* the packet is gathered from its fields, the destination is sent from
+     the message it keeps serialized */
+  dest = i2cp_destination_message(destination, &dest_length);
+
+  entry = NULL;
+  level = policy = i2cp_session_config_get_compression(i2cp_session_get_config(session));
+  if (policy == I2CP_COMPRESSION_AUTO)
+  {
+    entry = _client_compression_ratio(scratch, dest);
+    level = _client_compression_choose(entry, payload);
+  }
 
-  /* write payload into stream to be deflated */
+  /* deflate payload directly from the callers stream */
+  out = &scratch->deflate_stream;
+  stream_reset(out);
   stream_seek_set(payload, 0);
-  stream_out_stream(&in, payload);
-  stream_mark_end(&in);
-  stream_seek_set(&in, 0);
+  if (i2cp_codec_compress(scratch->codec, level, payload, out) < 0)
+  {
+    error(TAG, "%s", "failed to compress payload, too large for a message.");
+    return -1;
+  }
+  _session_account_send(session, level, stream_length(payload), stream_length(out));
 
-  _client_stream_deflate(&in, &out);
+  /* remember a moving average of the deflate ratio for destination */
+  if (entry && level != I2CP_COMPRESSION_STORED && stream_length(payload))
+    entry->ratio = (entry->ratio * 3
+		    + stream_length(out) * 1000 / stream_length(payload)) / 4;
 
   /* update gzip headers with protocol and ports */
-  stream_seek_set(&out, 0);
-  stream_skip(&out, 3);
-  stream_skip(&out, 1);
-  stream_out_uint16(&out, src_port);
-  stream_out_uint16(&out, dest_port);
-  stream_skip(&out, 1);
-  stream_out_uint8(&out, protocol);
-
-  stream_out_uint32(&self->message_stream, stream_length(&out));
-  stream_out_stream(&self->message_stream, &out);
-  stream_out_uint32(&self->message_stream, nonce);
-  stream_mark_end(&self->message_stream);
-
-  stream_destroy(&in);
-  stream_destroy(&out);
-
-  ret = _client_send_msg(self, I2CP_MSG_SEND_MESSAGE, &self->message_stream, queue);
+  stream_seek_set(out, 0);
+  stream_skip(out, 3);
+  stream_skip(out, 1);
+  stream_out_uint16(out, src_port);
+  stream_out_uint16(out, dest_port);
+  stream_skip(out, 1);
+  stream_out_uint8(out, protocol);
+
+  hs.data = hs.p = hs.end = head;
+  hs.size = sizeof(head);
+  stream_out_uint16(&hs, i2cp_session_get_id(session));
+
+  hs.data = hs.p = hs.end = size;
+  hs.size = sizeof(size);
+  stream_out_uint32(&hs, stream_length(out));
+
+  ts.data = ts.p = ts.end = trailer;
+  ts.size = sizeof(trailer);
+  stream_out_uint32(&ts, nonce);
+
+  /* flags and expiration in router time, which share one 8 byte date field */
+  if (type == I2CP_MSG_SEND_MESSAGE_EXPIRES)
+  {
+    expiration = 0;
+    if (options->ttl_ms)
+    {
+      gettimeofday(&tp, NULL);
+      expiration = (uint64_t)tp.tv_sec * 1000 + tp.tv_usec / 1000
+	+ self->router.date_offset + options->ttl_ms;
+    }
+    expiration = ((uint64_t)options->flags << 48) | (expiration & 0xffffffffffffULL);
+    stream_out_uint64(&ts, expiration);
+  }
+  stream_mark_end(&ts);
+
+  iov[0].iov_base = head;
+  iov[0].iov_len = sizeof(head);
+  iov[1].iov_base = (uint8_t *)dest;
+  iov[1].iov_len = dest_length;
+  iov[2].iov_base = size;
+  iov[2].iov_len = sizeof(size);
+  iov[3].iov_base = out->data;
+  iov[3].iov_len = stream_length(out);
+  iov[4].iov_base = trailer;
+  iov[4].iov_len = stream_length(&ts);
+
+  ret = _client_send_msgv(self, type, iov, 5, queue);
   if (ret <= 0)
+  {
     error(TAG, "%s", "error while sending SendMessageMessage.");
+    return -1;
+  }
+
+  return 0;
 }
 
 
+/* Send queued messages gathered into a single non blocking write of at most the
+   send batch size, whatever is left including the tail of a partially written
+   message is sent at next flush.
+ */
+static int
+_client_flush_output(i2cp_client_t *self)
+{
+  int ret, water;
+  int64_t avail;
+  size_t length;
+  stream_t *out;
+  struct iovec iov;
+
+  ret = 0;
+
+  pthread_mutex_lock(&self->output_lock);
+  _client_send_queue_drain(self, 0);
+  out = &self->output_stream;
+  if (!stream_eof(out) || tcp_send_pending(self->tcp))
+  {
+    length = out->end - out->p;
+    if (self->send_batch_bytes && length > self->send_batch_bytes)
+      length = self->send_batch_bytes;
+
+    /* shaper only limits data taken from queue, data pending in the
+       transport was accounted when taken */
+    avail = ratelimit_available(self->shaper);
+    if (avail <= 0)
+      length = 0;
+    else if (length > avail)
+      length = avail;
+
+    iov.iov_base = out->p;
+    iov.iov_len = length;
+
+    debug(TAG|PROTOCOL, "Sending %ld of %ld bytes queued", length, out->end - out->p);
+    ret = tcp_sendv(self->tcp, &iov, 1, TCP_SEND_NONBLOCK);
+    if (ret > 0)
+    {
+      out->p += ret;
+      ratelimit_consume(self->shaper, ret);
+    }
+  }
+
+  /* checked after the send queue was drained, also when nothing was sent */
+  water = _client_output_check_water(self);
+
+  if (stream_eof(out))
+    stream_reset(out);
+  pthread_mutex_unlock(&self->output_lock);
+
+  _client_dispatch_on_backpressure(self, water);
+
+  return ret;
+}
+
 struct i2cp_client_t *
 i2cp_client_new(i2cp_client_callbacks_t *callbacks)
 {
+  int i;
   i2cp_client_t *client = malloc(sizeof(i2cp_client_t));
   memset(client, 0, sizeof(i2cp_client_t));
 
@@ -1018,8 +2156,22 @@ i2cp_client_new(i2cp_client_callbacks_t *callbacks)
   client->logger.on_log = _client_on_log_callback;
   i2cp_logger_init(&client->logger);
 
-  stream_init(&client->output_stream, I2CP_MESSAGE_SIZE);
-  stream_init(&client->message_stream, I2CP_MESSAGE_SIZE);
+  client->poll_fd = -1;
+  client->poll_registered_fd = -1;
+  client->io_wake[0] = client->io_wake[1] = -1;
+  client->dispatch_wake[0] = client->dispatch_wake[1] = -1;
+
+  for (i = 0; i < I2CP_MSG_TYPES; i++)
+    client->handlers[i].fn = _client_default_handlers[i];
+
+  client->codec = i2cp_codec_new();
+
+  stream_init(&client->output_stream, I2CP_SEND_BUFFER_SIZE);
+  pthread_mutex_init(&client->output_lock, NULL);
+  mpsc_init(&client->send_queue);
+  client->shaper = ratelimit_new();
+  stream_init(&client->input_stream, I2CP_RECV_BUFFER_SIZE);
+  stream_init(&client->inflate_stream, I2CP_MESSAGE_SIZE);
 
   _client_default_properties(client);
 
@@ -1027,14 +2179,22 @@ i2cp_client_new(i2cp_client_callbacks_t *callbacks)
   client->tcp = tcp_new();
   tcp_set_property(client->tcp, TCP_PROP_ADDRESS, client->properties[CLIENT_PROP_ROUTER_ADDRESS]);
   tcp_set_property(client->tcp, TCP_PROP_PORT, client->properties[CLIENT_PROP_ROUTER_PORT]);
+  tcp_set_property(client->tcp, TCP_PROP_UNIX_PATH, client->properties[CLIENT_PROP_ROUTER_UNIX_PATH]);
 
 #ifdef WITH_GNUTLS
   tcp_set_property(client->tcp, TCP_PROP_USE_TLS, client->properties[CLIENT_PROP_ROUTER_USE_TLS]);
+  tcp_set_property(client->tcp, TCP_PROP_TLS_CA_FILE, client->properties[CLIENT_PROP_ROUTER_TLS_CA_FILE]);
+  tcp_set_property(client->tcp, TCP_PROP_TLS_PINNED_CERTIFICATE,
+		   client->properties[CLIENT_PROP_ROUTER_TLS_PINNED_CERTIFICATE]);
 #endif
 
+#ifdef WITH_IO_URING
+  tcp_set_property(client->tcp, TCP_PROP_USE_IO_URING, client->properties[CLIENT_PROP_ROUTER_USE_IO_URING]);
+#endif
+
+  pthread_mutex_init(&client->lookup_lock, NULL);
   client->lookups = stringmap_new(1000);
   client->lookup_requests = intmap_new(1000);
-  client->output_queue = queue_new();
 
   return client;
 }
@@ -1042,11 +2202,38 @@ i2cp_client_new(i2cp_client_callbacks_t *callbacks)
 void
 i2cp_client_destroy(struct i2cp_client_t *self)
 {
+  _client_dispatch_item_t *item;
+
+  i2cp_client_stop_io_thread(self);
+  i2cp_client_stop_dispatch_workers(self);
   if (i2cp_client_is_connected(self))
     i2cp_client_disconnect(self);
 
-  stream_destroy(&self->message_stream);
+  /* payloads not taken by the consumer */
+  if (self->dispatch_ring)
+  {
+    while ((item = spsc_pop(self->dispatch_ring)) != NULL)
+      free(item);
+    spsc_destroy(self->dispatch_ring);
+    i2cp_codec_destroy(self->dispatch_codec);
+    stream_destroy(&self->dispatch_stream);
+  }
+  _client_event_destroy(self->dispatch_wake);
+  _client_event_destroy(self->io_wake);
+
+  i2cp_codec_destroy(self->codec);
+  pthread_mutex_destroy(&self->lookup_lock);
+  _client_send_queue_drain(self, 1);
   stream_destroy(&self->output_stream);
+  pthread_mutex_destroy(&self->output_lock);
+  ratelimit_destroy(self->shaper);
+  stream_destroy(&self->input_stream);
+  stream_destroy(&self->inflate_stream);
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (self->poll_fd >= 0)
+    close(self->poll_fd);
+#endif
 
   free(self);
 }
@@ -1067,11 +2254,55 @@ i2cp_client_set_property(struct i2cp_client_t *self, i2cp_client_property_t prop
     tcp_set_property(self->tcp, TCP_PROP_PORT, self->properties[CLIENT_PROP_ROUTER_PORT]);
     break;
 
+  case CLIENT_PROP_ROUTER_UNIX_PATH:
+    tcp_set_property(self->tcp, TCP_PROP_UNIX_PATH, self->properties[CLIENT_PROP_ROUTER_UNIX_PATH]);
+    break;
+
   case CLIENT_PROP_ROUTER_USE_TLS:
 #ifdef WITH_GNUTLS
     tcp_set_property(self->tcp, TCP_PROP_USE_TLS, self->properties[CLIENT_PROP_ROUTER_USE_TLS]);
 #endif
     break;
+
+  case CLIENT_PROP_ROUTER_TLS_CA_FILE:
+#ifdef WITH_GNUTLS
+    tcp_set_property(self->tcp, TCP_PROP_TLS_CA_FILE, self->properties[CLIENT_PROP_ROUTER_TLS_CA_FILE]);
+#endif
+    break;
+
+  case CLIENT_PROP_ROUTER_TLS_PINNED_CERTIFICATE:
+#ifdef WITH_GNUTLS
+    tcp_set_property(self->tcp, TCP_PROP_TLS_PINNED_CERTIFICATE,
+		     self->properties[CLIENT_PROP_ROUTER_TLS_PINNED_CERTIFICATE]);
+#endif
+    break;
+
+  case CLIENT_PROP_ROUTER_USE_IO_URING:
+#ifdef WITH_IO_URING
+    tcp_set_property(self->tcp, TCP_PROP_USE_IO_URING, self->properties[CLIENT_PROP_ROUTER_USE_IO_URING]);
+#endif
+    break;
+
+  case CLIENT_PROP_SEND_BATCH_BYTES:
+    self->send_batch_bytes = value ? strtoul(value, NULL, 10) : 0;
+    break;
+
+  case CLIENT_PROP_SEND_HIGH_WATER:
+    self->send_high_water = value ? strtoul(value, NULL, 10) : 0;
+    break;
+
+  case CLIENT_PROP_RECV_ZERO_COPY:
+    self->recv_zero_copy = value && strcmp(value, "1") == 0;
+    break;
+
+  case CLIENT_PROP_SEND_RATE:
+    pthread_mutex_lock(&self->output_lock);
+    _client_shaper_update(self);
+    pthread_mutex_unlock(&self->output_lock);
+    break;
+
+  default:
+    break;
   }
 }
 
@@ -1082,27 +2313,143 @@ i2cp_client_get_property(struct i2cp_client_t *self, i2cp_client_property_t prop
 }
 
 void
-i2cp_client_connect(struct i2cp_client_t *self)
+i2cp_client_register_handler(struct i2cp_client_t *self, uint8_t type,
+			     i2cp_client_message_handler_t handler, void *opaque)
 {
-  info(TAG, "connecting to i2cp at %s:%s",
-       self->properties[CLIENT_PROP_ROUTER_ADDRESS],
-       self->properties[CLIENT_PROP_ROUTER_PORT]);
+  if (handler == NULL)
+  {
+    self->handlers[type].fn = _client_default_handlers[type];
+    self->handlers[type].opaque = NULL;
+    return;
+  }
 
-  tcp_connect(self->tcp);
+  self->handlers[type].fn = handler;
+  self->handlers[type].opaque = opaque;
+}
 
-  if (!tcp_is_connected(self->tcp))
-    return;
+/* Router connection is established, start the i2cp handshake by queueing
+   the protocol byte followed by GetDate, SetDate completes the handshake. */
+static void
+_client_handshake(i2cp_client_t *self)
+{
+  stream_t view;
 
+  /* start with empty io buffers */
+  stream_reset(&self->input_stream);
+  pthread_mutex_lock(&self->output_lock);
   stream_reset(&self->output_stream);
-  stream_out_uint8(&self->output_stream, I2CP_PROTOCOL_INIT);
-  stream_mark_end(&self->output_stream);
+  _client_send_queue_drain(self, 1);
+  self->send_above_water = 0;
 
   debug(TAG|PROTOCOL, "%s", "Sending protocol byte message.");
-  tcp_send(self->tcp, &self->output_stream);
+  _client_output_reserve(self, &view, 1);
+  stream_out_uint8(&view, I2CP_PROTOCOL_INIT);
+  self->output_stream.end = view.p;
+  pthread_mutex_unlock(&self->output_lock);
+
+  self->state = I2CP_CLIENT_STATE_AWAIT_SETDATE;
+  _client_msg_get_date(self, 1);
+}
+
+/* Handshake is completed, send CreateSession for the sessions created
+   while connecting. */
+static void
+_client_ready(i2cp_client_t *self)
+{
+  struct i2cp_session_t *session;
+
+  info(TAG, "%s", "connected to i2cp");
+
+  self->state = I2CP_CLIENT_STATE_READY;
+  _client_msg_get_bandwidth_limits(self, 1);
+
+  while (self->pending_sessions_sent < self->pending_session_count)
+  {
+    session = self->pending_sessions[self->pending_sessions_sent++];
+    _client_msg_create_session(self, i2cp_session_get_config(session), 1);
+  }
 
-  /* handshake get/set date */
-  _client_msg_get_date(self, 0);
-  _client_recv_msg(self, I2CP_MSG_SET_DATE, &self->message_stream, 1, NULL);
+  _client_dispatch_on_connected(self);
+}
+
+/* Advance a connect in progress without blocking */
+static void
+_client_connect_continue(i2cp_client_t *self)
+{
+  switch (tcp_connect_continue(self->tcp))
+  {
+  case TCP_STATE_RESOLVING:
+    self->state = I2CP_CLIENT_STATE_RESOLVING;
+    break;
+
+  case TCP_STATE_CONNECTING:
+    self->state = I2CP_CLIENT_STATE_CONNECTING;
+    break;
+
+  case TCP_STATE_TLS_HANDSHAKE:
+    self->state = I2CP_CLIENT_STATE_TLS_HANDSHAKE;
+    break;
+
+  case TCP_STATE_CONNECTED:
+    _client_handshake(self);
+    break;
+
+  case TCP_STATE_DISCONNECTED:
+    self->state = I2CP_CLIENT_STATE_DISCONNECTED;
+    self->pending_session_count = 0;
+    self->pending_sessions_sent = 0;
+    _client_dispatch_on_disconnect(self, "Failed to connect to router.");
+    break;
+  }
+}
+
+void
+i2cp_client_connect_async(struct i2cp_client_t *self)
+{
+  if (self->state != I2CP_CLIENT_STATE_DISCONNECTED)
+  {
+    info(TAG, "client %p is already connected or connecting", (void *)self);
+    return;
+  }
+
+  if (self->properties[CLIENT_PROP_ROUTER_UNIX_PATH])
+  {
+    info(TAG, "connecting to i2cp at %s", self->properties[CLIENT_PROP_ROUTER_UNIX_PATH]);
+  }
+  else
+  {
+    info(TAG, "connecting to i2cp at %s:%s",
+	 self->properties[CLIENT_PROP_ROUTER_ADDRESS],
+	 self->properties[CLIENT_PROP_ROUTER_PORT]);
+  }
+
+  /* the new socket may reuse the descriptor number of a closed one which
+     epoll dropped when it was closed, so it must be registered again */
+  self->poll_registered_fd = -1;
+
+  self->state = I2CP_CLIENT_STATE_RESOLVING;
+  tcp_connect_start(self->tcp);
+  _client_connect_continue(self);
+}
+
+void
+i2cp_client_connect(struct i2cp_client_t *self)
+{
+  i2cp_client_connect_async(self);
+
+  /* process io until handshake is completed or connect failed */
+  while (self->state != I2CP_CLIENT_STATE_READY
+	 && self->state != I2CP_CLIENT_STATE_DISCONNECTED)
+  {
+    if (i2cp_client_run(self, -1) < 0)
+      break;
+  }
+}
+
+i2cp_client_state_t
+i2cp_client_get_state(struct i2cp_client_t *self)
+{
+  return self->state;
 }
 
 int
@@ -1116,18 +2463,27 @@ i2cp_client_disconnect(struct i2cp_client_t *self)
 {
   info(TAG, "disconnection client %p", (void *)self);
   tcp_disconnect(self->tcp);
+  self->state = I2CP_CLIENT_STATE_DISCONNECTED;
+  self->pending_session_count = 0;
+  self->pending_sessions_sent = 0;
 }
 
-void
-i2cp_client_create_session(struct i2cp_client_t *self, struct i2cp_session_t *session)
+int
+i2cp_client_create_session_async(struct i2cp_client_t *self, struct i2cp_session_t *session)
 {
   struct i2cp_session_config_t *config;
 
   /* rejecet creating more sessions than there is allowed per client */
-  if (self->session_count == I2CP_MAX_SESSIONS_PER_CLIENT)
+  if (self->session_count + self->pending_session_count >= I2CP_MAX_SESSIONS_PER_CLIENT)
   {
     warning(TAG, "%s", "Maximum number of session per client connection reached.");
-    return;
+    return -1;
+  }
+
+  if (self->state == I2CP_CLIENT_STATE_DISCONNECTED)
+  {
+    warning(TAG, "%s", "Client is not connected, connect before creating sessions.");
+    return -1;
   }
 
   /*
@@ -1135,57 +2491,537 @@ i2cp_client_create_session(struct i2cp_client_t *self, struct i2cp_session_t *se
    */
   config = i2cp_session_get_config(session);
 
-  /* from 0.9.4 client versions set the following defaults  */
+  /* from 0.9.4 client versions set the following defaults, message status
+     is only requested if application set a message reliability */
   i2cp_session_config_set_property(config, SESSION_CONFIG_PROP_I2CP_FAST_RECEIVE, "true");
-  i2cp_session_config_set_property(config, SESSION_CONFIG_PROP_I2CP_MESSAGE_RELIABILITY, "none");
+  if (i2cp_session_config_get_property(config, SESSION_CONFIG_PROP_I2CP_MESSAGE_RELIABILITY) == NULL)
+    i2cp_session_config_set_property(config, SESSION_CONFIG_PROP_I2CP_MESSAGE_RELIABILITY, "none");
+
+  self->pending_sessions[self->pending_session_count++] = session;
 
-  /* send CreateSession message */
-  _client_msg_create_session(self, config, 0);
+  /* send CreateSession message, or when client is ready */
+  if (self->state == I2CP_CLIENT_STATE_READY)
+  {
+    self->pending_sessions_sent++;
+    _client_msg_create_session(self, config, 1);
+  }
 
-  /* receive SessionStatus message */
-  _client_recv_msg(self, I2CP_MSG_ANY, &self->message_stream, 1, session);
+  return 0;
+}
+
+static int
+_client_session_is_pending(i2cp_client_t *self, struct i2cp_session_t *session)
+{
+  int i;
+
+  for (i = 0; i < self->pending_session_count; i++)
+    if (self->pending_sessions[i] == session)
+      return 1;
+
+  return 0;
+}
+
+void
+i2cp_client_create_session(struct i2cp_client_t *self, struct i2cp_session_t *session)
+{
+  if (i2cp_client_create_session_async(self, session) < 0)
+    return;
+
+  /* process io until router responded with SessionStatus */
+  while (_client_session_is_pending(self, session)
+	 && self->state != I2CP_CLIENT_STATE_DISCONNECTED)
+  {
+    if (i2cp_client_run(self, -1) < 0)
+      break;
+  }
 }
 
 int
 i2cp_client_process_io(struct i2cp_client_t *self)
 {
   int ret;
-  stream_t *stream;
+
+  /* advance connect in progress until i2cp handshake can be started */
+  if (self->state >= I2CP_CLIENT_STATE_RESOLVING && self->state <= I2CP_CLIENT_STATE_TLS_HANDSHAKE)
+  {
+    _client_connect_continue(self);
+    if (self->state == I2CP_CLIENT_STATE_DISCONNECTED)
+      return -1;
+
+    if (self->state != I2CP_CLIENT_STATE_AWAIT_SETDATE)
+      return 0;
+  }
+
+  /* send queued messages */
+  ret = _client_flush_output(self);
+  if (ret < 0)
+    return ret;
+
+  /* dispatch messages left in receive buffer, then drain the socket in
+     large non blocking reads dispatching every complete message of each read */
+  _client_recv_dispatch(self);
+  while (tcp_is_connected(self->tcp) && !_client_recv_blocked(self))
+  {
+    ret = _client_recv_fill(self);
+    if (ret < 0 && errno == EAGAIN)
+      return 0;
+
+    if (ret <= 0)
+      return ret;
+
+    _client_recv_dispatch(self);
+  }
+
+  return ret;
+}
+
+int
+i2cp_client_get_fd(struct i2cp_client_t *self)
+{
+  return tcp_get_fd(self->tcp);
+}
+
+int
+i2cp_client_wants_write(struct i2cp_client_t *self)
+{
+  int ret;
+
+  /* connect in progress waits for the socket to connect or the TLS
+     handshake to flush its records */
+  if (self->state < I2CP_CLIENT_STATE_AWAIT_SETDATE)
+    return tcp_wants_write(self->tcp);
+
+  pthread_mutex_lock(&self->output_lock);
+  ret = ((!stream_eof(&self->output_stream) || !mpsc_is_empty(&self->send_queue))
+	 && ratelimit_available(self->shaper) > 0 && !tcp_send_blocked(self->tcp))
+    || tcp_send_pending(self->tcp);
+  pthread_mutex_unlock(&self->output_lock);
+
+  return ret;
+}
+
+int
+i2cp_client_send_delay(struct i2cp_client_t *self)
+{
+  int ret;
 
   ret = 0;
+  pthread_mutex_lock(&self->output_lock);
+  if (!stream_eof(&self->output_stream) || !mpsc_is_empty(&self->send_queue))
+    ret = ratelimit_delay(self->shaper);
+  pthread_mutex_unlock(&self->output_lock);
+
+  return ret;
+}
+
+void
+i2cp_client_request_bandwidth_limits(struct i2cp_client_t *self)
+{
+  _client_msg_get_bandwidth_limits(self, 1);
+}
+
+int
+i2cp_client_get_bandwidth_limits(struct i2cp_client_t *self, i2cp_bandwidth_limits_t *limits)
+{
+  int ret;
+
+  ret = -1;
+  pthread_mutex_lock(&self->output_lock);
+  if (self->has_bandwidth_limits)
+  {
+    *limits = self->bandwidth_limits;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&self->output_lock);
+
+  return ret;
+}
+
+/* Wait until the router connection is readable or writable as requested
+   or the io thread is woken */
+#ifdef HAVE_SYS_EPOLL_H
+static int
+_client_wait_io(i2cp_client_t *self, int fd, int read, int write, int timeout)
+{
+  int i, ret, op;
+  struct epoll_event ev, events[2];
+
+  if (self->poll_fd < 0)
+  {
+    self->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->poll_fd < 0)
+    {
+      error(TAG, "failed to create epoll instance with reason: %s", strerror(errno));
+      return -1;
+    }
+  }
+
+  /* the wake event stays registered once the io thread was started */
+  memset(&ev, 0, sizeof(ev));
+  if (self->io_wake[0] >= 0 && !self->poll_wake_registered)
+  {
+    ev.events = EPOLLIN;
+    ev.data.fd = self->io_wake[0];
+    if (epoll_ctl(self->poll_fd, EPOLL_CTL_ADD, self->io_wake[0], &ev) < 0)
+    {
+      error(TAG, "failed to register wake event with epoll with reason: %s", strerror(errno));
+      return -1;
+    }
+
+    self->poll_wake_registered = 1;
+  }
 
-  /* send messages in output queue */
-  queue_lock(self->output_queue);
-  stream = (stream_t *)queue_pop(self->output_queue);
-  while(stream)
+  /* update registration of socket and interest set if changed */
+  ev.events = (read ? EPOLLIN : 0) | (write ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  if (fd != self->poll_registered_fd || ev.events != self->poll_events)
   {
-    debug(TAG|PROTOCOL, "Sending %d bytes message", stream_length(stream)); 
-    ret = tcp_send(self->tcp, stream);
-    stream_destroy(stream);
-    free(stream);
+    op = (fd == self->poll_registered_fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    ret = epoll_ctl(self->poll_fd, op, fd, &ev);
+    if (ret < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+      ret = epoll_ctl(self->poll_fd, EPOLL_CTL_MOD, fd, &ev);
 
     if (ret < 0)
-      return ret;
+    {
+      error(TAG, "failed to register socket with epoll with reason: %s", strerror(errno));
+      return -1;
+    }
 
-    if (ret == 0)
-      break;
+    self->poll_registered_fd = fd;
+    self->poll_events = ev.events;
+  }
+
+  ret = epoll_wait(self->poll_fd, events, 2, timeout);
+  if (ret < 0 && errno == EINTR)
+    ret = 0;
+
+  for (i = 0; i < ret; i++)
+  {
+    if (events[i].data.fd == self->io_wake[0])
+      _client_io_woken(self);
+  }
+
+  return ret;
+}
+#else
+static int
+_client_wait_io(i2cp_client_t *self, int fd, int read, int write, int timeout)
+{
+  int ret, nfds;
+  struct pollfd pfd[2];
+
+  pfd[0].fd = fd;
+  pfd[0].events = (read ? POLLIN : 0) | (write ? POLLOUT : 0);
+  pfd[0].revents = 0;
+
+  nfds = 1;
+  if (self->io_wake[0] >= 0)
+  {
+    pfd[1].fd = self->io_wake[0];
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    nfds++;
+  }
+
+  ret = poll(pfd, nfds, timeout);
+  if (ret < 0 && errno == EINTR)
+    ret = 0;
+
+  if (nfds > 1 && (pfd[1].revents & POLLIN))
+    _client_io_woken(self);
+
+  return ret;
+}
+#endif
+
+int
+i2cp_client_run(struct i2cp_client_t *self, int timeout)
+{
+  int fd, ret, delay;
 
-    stream = (stream_t *)queue_pop(self->output_queue);
+  /* there is no socket to wait for until the router hostname is resolved */
+  if (self->state == I2CP_CLIENT_STATE_RESOLVING)
+  {
+    tcp_wait_resolve(self->tcp, timeout);
+    return i2cp_client_process_io(self);
   }
-  queue_unlock(self->output_queue);
 
-  /* drain incoming message */
-  while (tcp_can_read(self->tcp))
+  fd = i2cp_client_get_fd(self);
+  if (fd < 0)
+    return -1;
+
+  /* wake up when shaper allows sending queued data */
+  delay = i2cp_client_send_delay(self);
+  if (delay > 0 && (timeout < 0 || delay < timeout))
+    timeout = delay;
+
+  /* messages already buffered are dispatched without waiting, the socket
+     isn't polled for reading while the consumer holds back receive */
+  if (_client_recv_dispatch(self) == 0)
   {
-    ret = _client_recv_msg(self, I2CP_MSG_ANY, &self->message_stream, 1, NULL);
+    /* a full send ring of io_uring waits on completions instead */
+    ret = _client_wait_io(self, fd, !_client_recv_blocked(self) || tcp_send_blocked(self->tcp),
+			  i2cp_client_wants_write(self), timeout);
     if (ret < 0)
       return ret;
+  }
+
+  return i2cp_client_process_io(self);
+}
 
-    if (ret == 0)
+static void *
+_client_io_thread(void *opaque)
+{
+  i2cp_client_t *self;
+
+  self = (i2cp_client_t *)opaque;
+  while (!atomic_load(&self->io_stop))
+  {
+    if (i2cp_client_run(self, -1) < 0)
       break;
   }
 
-  return ret;
+  /* a consumer waiting for payloads returns when io has ended */
+  if (self->dispatch_ring)
+    _client_event_signal(self->dispatch_wake);
+
+  return NULL;
+}
+
+int
+i2cp_client_start_io_thread(struct i2cp_client_t *self, i2cp_client_dispatch_t dispatch)
+{
+  if (self->io_thread_running)
+  {
+    warning(TAG, "%s", "io thread is already running.");
+    return -1;
+  }
+
+  if (self->io_wake[0] < 0 && _client_event_init(self->io_wake) < 0)
+  {
+    error(TAG, "failed to create wake event with reason: %s", strerror(errno));
+    return -1;
+  }
+
+  if (dispatch == CLIENT_DISPATCH_CONSUMER && self->dispatch_ring == NULL)
+  {
+    if (_client_event_init(self->dispatch_wake) < 0)
+    {
+      error(TAG, "failed to create dispatch event with reason: %s", strerror(errno));
+      return -1;
+    }
+
+    self->dispatch_ring = spsc_new(I2CP_DISPATCH_RING_SIZE);
+    self->dispatch_codec = i2cp_codec_new();
+    stream_init(&self->dispatch_stream, I2CP_MESSAGE_SIZE);
+  }
+
+  self->dispatch = dispatch;
+  atomic_store(&self->io_stop, 0);
+  if (pthread_create(&self->io_thread, NULL, _client_io_thread, self) != 0)
+  {
+    error(TAG, "%s", "failed to create io thread.");
+    return -1;
+  }
+
+  self->io_thread_running = 1;
+  return 0;
+}
+
+void
+i2cp_client_stop_io_thread(struct i2cp_client_t *self)
+{
+  if (!self->io_thread_running)
+    return;
+
+  atomic_store(&self->io_stop, 1);
+  _client_event_signal(self->io_wake);
+  pthread_join(self->io_thread, NULL);
+  self->io_thread_running = 0;
+}
+
+/* Dispatch payloads on ring, run by the consumer or a worker thread */
+static int
+_client_dispatch_drain(i2cp_client_t *self, struct spsc_t *ring,
+		       struct i2cp_codec_t *codec, stream_t *inflate)
+{
+  int cnt;
+  stream_t view;
+  _client_dispatch_item_t *item;
+
+  cnt = 0;
+  while ((item = spsc_pop(ring)) != NULL)
+  {
+    view.data = view.p = item->data;
+    view.size = item->length;
+    view.end = view.data + item->length;
+    _client_payload_dispatch(self, item->session, &view, codec, inflate);
+    free(item);
+    cnt++;
+
+    /* io thread resumes receiving once half of the ring is free */
+    if (atomic_load(&self->dispatch_blocked)
+	&& spsc_count(ring) <= I2CP_DISPATCH_RING_SIZE / 2
+	&& atomic_exchange(&self->dispatch_blocked, 0))
+      _client_io_wake(self);
+  }
+
+  return cnt;
+}
+
+int
+i2cp_client_get_dispatch_fd(struct i2cp_client_t *self)
+{
+  return self->dispatch_wake[0];
+}
+
+int
+i2cp_client_dispatch(struct i2cp_client_t *self, int timeout)
+{
+  struct pollfd pfd;
+
+  if (self->dispatch_ring == NULL)
+    return -1;
+
+  if (timeout != 0 && spsc_is_empty(self->dispatch_ring))
+  {
+    pfd.fd = self->dispatch_wake[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+      return -1;
+  }
+
+  /* cleared before draining, payloads pushed after the drain signal again */
+  _client_event_clear(self->dispatch_wake);
+
+  return _client_dispatch_drain(self, self->dispatch_ring,
+				self->dispatch_codec, &self->dispatch_stream);
+}
+
+static void *
+_client_worker_thread(void *opaque)
+{
+  struct pollfd pfd;
+  _client_worker_t *worker;
+
+  worker = (_client_worker_t *)opaque;
+  pfd.fd = worker->wake[0];
+  pfd.events = POLLIN;
+  while (!atomic_load(&worker->stop))
+  {
+    pfd.revents = 0;
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      break;
+
+    _client_event_clear(worker->wake);
+    _client_dispatch_drain(worker->client, worker->ring,
+			   worker->codec, &worker->inflate_stream);
+  }
+
+  return NULL;
+}
+
+int
+i2cp_client_start_dispatch_workers(struct i2cp_client_t *self, int count)
+{
+  int i;
+  _client_worker_t *worker;
+
+  if (self->worker_count)
+  {
+    warning(TAG, "%s", "dispatch workers are already running.");
+    return -1;
+  }
+
+  /* more workers than sessions would stay idle */
+  if (count < 1 || count > I2CP_MAX_SESSIONS_PER_CLIENT)
+  {
+    warning(TAG, "Invalid number of dispatch workers %d.", count);
+    return -1;
+  }
+
+  /* workers wake the thread running io to move parked payloads */
+  if (self->io_wake[0] < 0 && _client_event_init(self->io_wake) < 0)
+  {
+    error(TAG, "failed to create wake event with reason: %s", strerror(errno));
+    return -1;
+  }
+
+  self->workers = malloc(count * sizeof(_client_worker_t));
+  memset(self->workers, 0, count * sizeof(_client_worker_t));
+  for (i = 0; i < count; i++)
+  {
+    worker = &self->workers[i];
+    worker->client = self;
+    if (_client_event_init(worker->wake) < 0)
+    {
+      error(TAG, "failed to create worker event with reason: %s", strerror(errno));
+      break;
+    }
+
+    worker->ring = spsc_new(I2CP_DISPATCH_RING_SIZE);
+    worker->codec = i2cp_codec_new();
+    stream_init(&worker->inflate_stream, I2CP_MESSAGE_SIZE);
+    if (pthread_create(&worker->thread, NULL, _client_worker_thread, worker) != 0)
+    {
+      error(TAG, "%s", "failed to create dispatch worker thread.");
+      break;
+    }
+
+    self->worker_count++;
+  }
+
+  /* workers started so far and the one failing are torn down */
+  if (self->worker_count < count)
+  {
+    worker = &self->workers[self->worker_count];
+    if (worker->ring)
+    {
+      spsc_destroy(worker->ring);
+      i2cp_codec_destroy(worker->codec);
+      stream_destroy(&worker->inflate_stream);
+    }
+    _client_event_destroy(worker->wake);
+    i2cp_client_stop_dispatch_workers(self);
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+i2cp_client_stop_dispatch_workers(struct i2cp_client_t *self)
+{
+  int i;
+  _client_worker_t *worker;
+  _client_dispatch_item_t *item;
+
+  for (i = 0; i < self->worker_count; i++)
+  {
+    worker = &self->workers[i];
+    atomic_store(&worker->stop, 1);
+    _client_event_signal(worker->wake);
+    pthread_join(worker->thread, NULL);
+
+    /* payloads not dispatched yet */
+    while ((item = spsc_pop(worker->ring)) != NULL)
+      free(item);
+    while ((item = worker->parked_head) != NULL)
+    {
+      worker->parked_head = item->next;
+      free(item);
+    }
+
+    spsc_destroy(worker->ring);
+    i2cp_codec_destroy(worker->codec);
+    stream_destroy(&worker->inflate_stream);
+    _client_event_destroy(worker->wake);
+  }
+
+  free(self->workers);
+  self->workers = NULL;
+  self->worker_count = 0;
 }
 
 uint32_t
@@ -1225,9 +3061,17 @@ i2cp_client_destination_lookup(struct i2cp_client_t *self,
   /* Create a client host lookup item for this request id and add it to the map */
   lup = _client_host_lookup_item_ctor(address, session);
 
+  /* register request before sending it, the reply is handled on the io
+     thread */
+  pthread_mutex_lock(&self->lookup_lock);
+
   /* FIXME: using 0 as intmap key is invalid */
   request_id = (++self->lookup_request_id);
   intmap_put(self->lookup_requests, request_id, lup);
+  if (!(self->router.capabilities & ROUTER_CAN_HOST_LOOKUP))
+    stringmap_put(self->lookups, address, (void *)request_id);
+
+  pthread_mutex_unlock(&self->lookup_lock);
 
   if (self->router.capabilities & ROUTER_CAN_HOST_LOOKUP)
   {
@@ -1242,7 +3086,6 @@ i2cp_client_destination_lookup(struct i2cp_client_t *self,
   else
   {
     /* pre 0.9.10 approach of dest lookup */
-    stringmap_put(self->lookups, address, (void *)request_id);
     _client_msg_dest_lookup(self, out.data, 1);
   }
 
@@ -0,0 +1,335 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <i2cp/config.h>
+
+#if defined(WITH_LIBDEFLATE)
+#include <libdeflate.h>
+#define _codec_crc32(crc, buf, len) libdeflate_crc32(crc, buf, len)
+#elif defined(WITH_ZLIB_NG)
+#include <zlib-ng.h>
+#define Z(fn) zng_ ## fn
+typedef zng_stream _codec_z_stream;
+#define _codec_crc32(crc, buf, len) zng_crc32(crc, buf, len)
+#else
+#include <zlib.h>
+#define Z(fn) fn
+typedef z_stream _codec_z_stream;
+#define _codec_crc32(crc, buf, len) crc32(crc, buf, len)
+#endif
+
+#include <i2cp/codec.h>
+#include <i2cp/logger.h>
+#include <i2cp/stream.h>
+#include <i2cp/session_config.h>
+
+#define TAG CODEC
+
+/* gzip header and trailer sizes, deflate streams are written with a
+   plain header and without a header crc */
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+
+typedef struct i2cp_codec_t
+{
+#if defined(WITH_LIBDEFLATE)
+  /* one shot compressors by level, allocated on first use */
+  struct libdeflate_compressor *compressors[10];
+  struct libdeflate_decompressor *decompressor;
+#else
+  /* long lived contexts, reset for each stream */
+  _codec_z_stream deflate;
+  int level;
+  _codec_z_stream inflate;
+#endif
+} i2cp_codec_t;
+
+/* Write stream as a gzip stream of stored blocks, costs a crc32 and a copy
+   of the payload. Header and trailer are written as deflate would so the
+   ports and protocol are patched in the same way. */
+static int
+_codec_store(stream_t *in, stream_t *out)
+{
+  uint8_t *src;
+  uint32_t crc;
+  size_t length, block;
+
+  src = in->p;
+  length = stream_length(in) - stream_tell(in);
+
+  /* header, a final block of each 0xffff bytes and trailer */
+  if (GZIP_HEADER_SIZE + 5 * (length / 0xffff + 1) + length + GZIP_TRAILER_SIZE
+      > stream_size(out) - stream_tell(out))
+  {
+    warning(TAG, "Failed to store stream of %zu bytes, exceeds buffer.", length);
+    return -1;
+  }
+
+  /* gzip header: magic, deflate, no flags, mtime, xfl, unix */
+  stream_out_uint8(out, 0x1f);
+  stream_out_uint8(out, 0x8b);
+  stream_out_uint8(out, 8);
+  stream_out_uint8(out, 0);
+  stream_out_uint32(out, 0);
+  stream_out_uint8(out, 0);
+  stream_out_uint8(out, 3);
+
+  /* stored blocks, lengths are little endian */
+  do {
+    block = length > 0xffff ? 0xffff : length;
+    stream_out_uint8(out, block == length ? 1 : 0);
+    stream_out_uint8(out, block & 0xff);
+    stream_out_uint8(out, block >> 8);
+    stream_out_uint8(out, ~block & 0xff);
+    stream_out_uint8(out, (~block >> 8) & 0xff);
+    stream_out_uint8p(out, src, block);
+    src += block;
+    length -= block;
+  } while (length);
+
+  /* trailer: crc32 and input size, little endian */
+  length = src - in->p;
+  crc = _codec_crc32(0, in->p, length);
+  stream_out_uint8(out, crc & 0xff);
+  stream_out_uint8(out, (crc >> 8) & 0xff);
+  stream_out_uint8(out, (crc >> 16) & 0xff);
+  stream_out_uint8(out, (crc >> 24) & 0xff);
+  stream_out_uint8(out, length & 0xff);
+  stream_out_uint8(out, (length >> 8) & 0xff);
+  stream_out_uint8(out, (length >> 16) & 0xff);
+  stream_out_uint8(out, (length >> 24) & 0xff);
+
+  stream_mark_end(out);
+  return 0;
+}
+
+uint32_t
+i2cp_codec_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+  return _codec_crc32(crc, buf, len);
+}
+
+#if defined(WITH_LIBDEFLATE)
+
+struct i2cp_codec_t *
+i2cp_codec_new()
+{
+  i2cp_codec_t *codec;
+
+  codec = malloc(sizeof(i2cp_codec_t));
+  memset(codec, 0, sizeof(i2cp_codec_t));
+
+  codec->decompressor = libdeflate_alloc_decompressor();
+  if (codec->decompressor == NULL)
+    fatal(TAG|FATAL, "%s", "Failed to allocate libdeflate decompressor.");
+
+  return codec;
+}
+
+void
+i2cp_codec_destroy(struct i2cp_codec_t *self)
+{
+  int i;
+
+  for (i = 0; i < 10; i++)
+    libdeflate_free_compressor(self->compressors[i]);
+  libdeflate_free_decompressor(self->decompressor);
+  free(self);
+}
+
+const char *
+i2cp_codec_name()
+{
+  return "libdeflate";
+}
+
+int
+i2cp_codec_compress(struct i2cp_codec_t *self, int level, stream_t *in, stream_t *out)
+{
+  size_t ret;
+
+  if (level == I2CP_COMPRESSION_STORED || level == 0)
+    return _codec_store(in, out);
+
+  if (self->compressors[level] == NULL)
+  {
+    self->compressors[level] = libdeflate_alloc_compressor(level);
+    if (self->compressors[level] == NULL)
+    {
+      warning(TAG, "Failed to allocate libdeflate compressor of level %d.", level);
+      return -1;
+    }
+  }
+
+  ret = libdeflate_gzip_compress(self->compressors[level],
+				 in->p, stream_length(in) - stream_tell(in),
+				 out->p, stream_size(out) - stream_tell(out));
+  if (ret == 0)
+  {
+    warning(TAG, "%s", "Failed to compress stream, exceeds buffer.");
+    return -1;
+  }
+
+  out->p += ret;
+  stream_mark_end(out);
+  return 0;
+}
+
+int
+i2cp_codec_decompress(struct i2cp_codec_t *self, stream_t *in, stream_t *out)
+{
+  size_t length;
+  enum libdeflate_result ret;
+
+  ret = libdeflate_gzip_decompress(self->decompressor,
+				   in->p, stream_length(in) - stream_tell(in),
+				   out->p, stream_size(out) - stream_tell(out),
+				   &length);
+  if (ret != LIBDEFLATE_SUCCESS)
+  {
+    warning(TAG, "Failed to decompress stream with reason %d.", ret);
+    return -1;
+  }
+
+  out->p += length;
+  stream_mark_end(out);
+  return 0;
+}
+
+#else
+
+struct i2cp_codec_t *
+i2cp_codec_new()
+{
+  i2cp_codec_t *codec;
+
+  codec = malloc(sizeof(i2cp_codec_t));
+  memset(codec, 0, sizeof(i2cp_codec_t));
+
+  /* gzip wrapper for both directions */
+  codec->level = I2CP_COMPRESSION_DEFAULT;
+  if (Z(deflateInit2)(&codec->deflate, codec->level, Z_DEFLATED, MAX_WBITS+16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    fatal(TAG|FATAL, "Failed to initialize deflate with reason: %s", codec->deflate.msg);
+  if (Z(inflateInit2)(&codec->inflate, MAX_WBITS+16) != Z_OK)
+    fatal(TAG|FATAL, "Failed to initialize inflate with reason: %s", codec->inflate.msg);
+
+  return codec;
+}
+
+void
+i2cp_codec_destroy(struct i2cp_codec_t *self)
+{
+  Z(deflateEnd)(&self->deflate);
+  Z(inflateEnd)(&self->inflate);
+  free(self);
+}
+
+const char *
+i2cp_codec_name()
+{
+#if defined(WITH_ZLIB_NG)
+  return "zlib-ng";
+#else
+  return "zlib";
+#endif
+}
+
+int
+i2cp_codec_compress(struct i2cp_codec_t *self, int level, stream_t *in, stream_t *out)
+{
+  int ret;
+  _codec_z_stream *zs;
+
+  if (level == I2CP_COMPRESSION_STORED)
+    return _codec_store(in, out);
+
+  zs = &self->deflate;
+  ret = Z(deflateReset)(zs);
+  if (ret != Z_OK)
+  {
+    warning(TAG, "Failed to reset deflate of stream with reason: %s", zs->msg);
+    return -1;
+  }
+
+  /* level can only be changed before any input of the stream */
+  if (level != self->level)
+  {
+    ret = Z(deflateParams)(zs, level, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK)
+    {
+      warning(TAG, "Failed to set deflate level %d with reason: %s", level, zs->msg);
+      return -1;
+    }
+    self->level = level;
+  }
+
+  zs->next_in = in->p;
+  zs->avail_in = stream_length(in) - stream_tell(in);
+  zs->next_out = out->p;
+  zs->avail_out = stream_size(out) - stream_tell(out);
+
+  /* compress of stream */
+  ret = Z(deflate)(zs, Z_FINISH);
+  if (ret != Z_STREAM_END)
+  {
+    warning(TAG, "Failed to deflate of stream with reason %d: %s", ret, zs->msg);
+    return -1;
+  }
+
+  out->p += zs->total_out;
+  stream_mark_end(out);
+  return 0;
+}
+
+int
+i2cp_codec_decompress(struct i2cp_codec_t *self, stream_t *in, stream_t *out)
+{
+  int ret;
+  _codec_z_stream *zs;
+
+  zs = &self->inflate;
+  ret = Z(inflateReset)(zs);
+  if (ret != Z_OK)
+  {
+    warning(TAG, "Failed to reset inflate of stream with reason: %s", zs->msg);
+    return -1;
+  }
+
+  zs->next_in = in->p;
+  zs->avail_in = stream_length(in) - stream_tell(in);
+  zs->next_out = out->p;
+  zs->avail_out = stream_size(out) - stream_tell(out);
+
+  /* decompress stream */
+  ret = Z(inflate)(zs, Z_FINISH);
+  if (ret != Z_STREAM_END)
+  {
+    warning(TAG, "Failed to inflate of stream with reason %d: %s", ret, zs->msg);
+    return -1;
+  }
+
+  out->p += zs->total_out;
+  stream_mark_end(out);
+  return 0;
+}
+
+#endif
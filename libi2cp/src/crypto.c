@@ -44,6 +44,22 @@ typedef struct i2cp_crypto_t
 
 static i2cp_crypto_t *_crypto;
 
+/* Export integer big endian into len bytes with leading zero bytes, returns
+   the bytes needed which is more than len if the integer doesn't fit. */
+static size_t
+_mpz_export_fixed(uint8_t *out, size_t len, const mpz_t value)
+{
+  size_t bytes;
+
+  bytes = (mpz_sizeinbase(value, 2) + 7) / 8;
+  if (bytes > len)
+    return bytes;
+
+  memset(out, 0, len);
+  mpz_export(out + len - bytes, NULL, 1, 1, 0, 0, value);
+  return len;
+}
+
 static void
 _encode_base64_stream(i2cp_crypto_t *self, stream_t *src, stream_t *dest)
 {
@@ -409,7 +425,7 @@ i2cp_crypto_signature_publickey_stream(struct i2cp_crypto_t *self,
 
   if (keypair->type == DSA_SHA1)
   {
-    mpz_export(stream->p, &bytes, 1, 1, 0, 0, keypair->dsa_public);
+    bytes = _mpz_export_fixed(stream->p, 128, keypair->dsa_public);
     if (bytes != 128)
       fatal(TAG|FATAL, "Sign pubkey length %d != 128 bytes", bytes);
   }
@@ -490,13 +506,13 @@ i2cp_crypto_signature_keypair_to_stream(struct i2cp_crypto_t *self,
   if (keypair->type == DSA_SHA1)
   {
     /* write private key */
-    mpz_export(stream->p, &bytes, 1, 1, 0, 0, keypair->dsa_private);
+    bytes = _mpz_export_fixed(stream->p, 20, keypair->dsa_private);
     if (bytes != 20)
       fatal(TAG, "failed to export signature private key, %d != 20", bytes);
     stream->p += bytes;
 
     /* write public key */
-    mpz_export(stream->p, &bytes, 1, 1, 0, 0, keypair->dsa_public);
+    bytes = _mpz_export_fixed(stream->p, 128, keypair->dsa_public);
     if (bytes != 128)
       fatal(TAG, "failed to export signature private key, %d != 128", bytes);
     stream->p += bytes;
@@ -17,6 +17,7 @@
 */
 
 #include <memory.h>
+#include <stdatomic.h>
 #include <i2cp/destination.h>
 #include <i2cp/crypto.h>
 #include <i2cp/certificate.h>
@@ -29,8 +30,14 @@ typedef struct i2cp_destination_t
   i2cp_signature_keypair_t signature_keypair;
   uint8_t public_key[256];
   uint8_t digest[40];
-  const char *b32;
-  const char *b64;
+  /* hash and addresses are generated on first access and installed by
+     compare and swap, a thread losing the race frees its copy */
+  _Atomic(uint8_t *) hash;
+  _Atomic(char *) b32;
+  _Atomic(char *) b64;
+
+  /* wire form of the destination, serialized once at construction */
+  stream_t message;
 } i2cp_destination_t;
 
 static void
@@ -41,13 +48,42 @@ _destination_dtor(struct i2cp_destination_t *self)
 
   i2cp_certificate_destroy(self->certificate);
 
-  free((char *)self->b32);
+  free(atomic_load(&self->hash));
 
-  free((char *)self->b64);
+  free(atomic_load(&self->b32));
+
+  free(atomic_load(&self->b64));
+
+  free(self->message.data);
 
   free(self);
 }
 
+/* Serialize destination message into the buffer it is sent from, must be
+   called when keys and certificate are set */
+static void
+_destination_serialize(struct i2cp_destination_t *self)
+{
+  stream_t *s;
+
+  s = &self->message;
+  stream_init(s, 4096);
+
+  /* write public key */
+  stream_out_uint8p(s, self->public_key, 256);
+
+  /* write sign pubkey */
+  i2cp_crypto_signature_publickey_stream(i2cp_crypto_instance(), &self->signature_keypair, s);
+
+  /* write certificate */
+  i2cp_certificate_get_message(self->certificate, s);
+
+  /* keep only the message */
+  s->size = stream_length(s);
+  s->data = realloc(s->data, s->size);
+  s->p = s->end = s->data + s->size;
+}
+
 static  int
 _destination_verify(struct i2cp_destination_t *self)
 {
@@ -62,40 +98,67 @@ _destination_verify(struct i2cp_destination_t *self)
   return i2cp_crypto_verify_stream(i2cp_crypto_instance(), &self->signature_keypair, &s);
 }
 
-static void
-_destination_generate_b32(struct i2cp_destination_t *self)
+static const uint8_t *
+_destination_generate_hash(struct i2cp_destination_t *self)
 {
-  stream_t stream, hash;
+  uint8_t *hash, *installed;
+  stream_t message, out;
+
+  /* sha256 hash of destination message */
+  hash = malloc(32);
+  message = self->message;
+  out.data = out.p = out.end = hash;
+  out.size = 32;
+  i2cp_crypto_hash_stream(i2cp_crypto_instance(), HASH_SHA256, &message, &out);
+
+  installed = NULL;
+  if (!atomic_compare_exchange_strong(&self->hash, &installed, hash))
+  {
+    free(hash);
+    return installed;
+  }
 
-  /* generate b32 address of destination */
-  stream_init(&stream, 4096);
-  stream_init(&hash, 512);
-  i2cp_destination_get_message(self, &stream);
-  i2cp_crypto_hash_stream(i2cp_crypto_instance(), HASH_SHA256, &stream, &hash);
-  stream_reset(&stream);
-  i2cp_crypto_encode_stream(i2cp_crypto_instance(), CODEC_BASE32, &hash, &stream);
-  stream_out_uint8p(&stream, ".b32.i2p\0", sizeof(".b32.i2p\0"));
-  self->b32 = strdup((char *)stream.data);
+  return hash;
+}
 
-  stream_destroy(&stream);
-  stream_destroy(&hash);
+static const char *
+_destination_generate_b32(struct i2cp_destination_t *self)
+{
+  char *b32, *installed;
+  stream_t hash, out;
+
+  /* generate b32 address of destination, 52 characters and suffix */
+  hash.data = hash.p = (uint8_t *)i2cp_destination_hash(self);
+  hash.end = hash.data + 32;
+  hash.size = 32;
+  stream_init(&out, 64);
+  i2cp_crypto_encode_stream(i2cp_crypto_instance(), CODEC_BASE32, &hash, &out);
+  stream_out_uint8p(&out, ".b32.i2p\0", sizeof(".b32.i2p\0"));
+  b32 = (char *)out.data;
+
+  installed = NULL;
+  if (!atomic_compare_exchange_strong(&self->b32, &installed, b32))
+  {
+    free(b32);
+    return installed;
+  }
 
-  debug(TAG, "New destination: %s", self->b32);
+  debug(TAG, "New destination: %s", b32);
+  return b32;
 }
 
-static void
+static const char *
 _destination_generate_b64(struct i2cp_destination_t *self)
 {
-  char *b64;
+  char *b64, *installed;
   char *p;
   stream_t in, out;
 
-  stream_init(&in, 4096);
-  stream_init(&out, 4096);
-
-  i2cp_destination_get_message(self, &in);
+  /* encode into a zeroed buffer which terminates the string */
+  in = self->message;
+  stream_init(&out, (stream_length(&in) + 2) / 3 * 4 + 1);
   i2cp_crypto_encode_stream(i2cp_crypto_instance(), CODEC_BASE64, &in, &out);
-  b64 = strdup((char *)out.data);
+  b64 = (char *)out.data;
 
   /* urlify base64 encoding */
   p = b64;
@@ -103,15 +166,20 @@ _destination_generate_b64(struct i2cp_destination_t *self)
     if (*p == '/') *p = '~';
     else if (*p == '+') *p = '-';
 
-  stream_destroy(&in);
-  stream_destroy(&out);
+  installed = NULL;
+  if (!atomic_compare_exchange_strong(&self->b64, &installed, b64))
+  {
+    free(b64);
+    return installed;
+  }
 
-  self->b64 = b64;
+  return b64;
 }
 
 struct i2cp_destination_t *
 i2cp_destination_copy(const struct i2cp_destination_t *src)
 {
+  void *p;
   i2cp_destination_t *dest;
 
   /* allocate destination */
@@ -124,8 +192,17 @@ i2cp_destination_copy(const struct i2cp_destination_t *src)
   memcpy(dest->digest, src->digest, sizeof(dest->digest));
 
   dest->certificate = i2cp_certificate_copy(src->certificate);
-  dest->b32 = strdup(src->b32);
-  dest->b64 = strdup(src->b64);
+  stream_init(&dest->message, stream_size(&src->message));
+  stream_out_stream(&dest->message, &src->message);
+  stream_mark_end(&dest->message);
+
+  /* take over what source has generated */
+  if ((p = atomic_load(&src->hash)) != NULL)
+    atomic_init(&dest->hash, memcpy(malloc(32), p, 32));
+  if ((p = atomic_load(&src->b32)) != NULL)
+    atomic_init(&dest->b32, strdup((char *)p));
+  if ((p = atomic_load(&src->b64)) != NULL)
+    atomic_init(&dest->b64, strdup((char *)p));
 
   return dest;
 }
@@ -142,10 +219,7 @@ i2cp_destination_new()
 
   /* generate signature keypair for the new destination */
   i2cp_crypto_signature_keygen(i2cp_crypto_instance(), DSA_SHA1, &dest->signature_keypair);
-
-  /* generate b32 and b64 addresss */
-  _destination_generate_b32(dest);
-  _destination_generate_b64(dest);
+  _destination_serialize(dest);
 
   return dest;
 }
@@ -174,10 +248,7 @@ i2cp_destination_new_from_message(stream_t *stream)
     _destination_dtor(dest);
     return NULL;
   }
-
-  /* generate b32 and b64 addresses */
-  _destination_generate_b32(dest);
-  _destination_generate_b64(dest);
+  _destination_serialize(dest);
 
   return dest;
 }
@@ -207,10 +278,7 @@ i2cp_destination_new_from_stream(stream_t *stream)
   if (plen != 256)
     fatal(TAG, "Failed to load public key len, %d != 256.", plen);
   stream_in_uint8p(stream, dest->public_key, 256);
-
-  /* generate b32 and b64 addresses */
-  _destination_generate_b32(dest);
-  _destination_generate_b64(dest);
+  _destination_serialize(dest);
 
   return dest;
 }
@@ -303,32 +371,55 @@ void i2cp_destination_destroy(struct i2cp_destination_t *self)
 
 void i2cp_destination_get_message(struct i2cp_destination_t *self, stream_t *stream)
 {
-  /* write public key */
-  stream_out_uint8p(stream, self->public_key, 256);
-
-  /* write sign pubkey */
-  i2cp_crypto_signature_publickey_stream(i2cp_crypto_instance(), &self->signature_keypair, stream);
-
-  /* write certificate */
-  i2cp_certificate_get_message(self->certificate, stream);
-
+  stream_out_stream(stream, &self->message);
   stream_mark_end(stream);
 }
 
+const uint8_t *
+i2cp_destination_message(const struct i2cp_destination_t *self, size_t *length)
+{
+  *length = stream_length(&self->message);
+  return self->message.data;
+}
+
 const i2cp_signature_keypair_t *
 i2cp_destination_signature_keypair(struct i2cp_destination_t *self)
 {
   return &self->signature_keypair;
 }
 
+const uint8_t *
+i2cp_destination_hash(const struct i2cp_destination_t *self)
+{
+  uint8_t *hash;
+
+  hash = atomic_load(&self->hash);
+  if (hash)
+    return hash;
+
+  return _destination_generate_hash((struct i2cp_destination_t *)self);
+}
+
 const char *
 i2cp_destination_b32(const struct i2cp_destination_t *self)
 {
-  return self->b32;
+  char *b32;
+
+  b32 = atomic_load(&self->b32);
+  if (b32)
+    return b32;
+
+  return _destination_generate_b32((struct i2cp_destination_t *)self);
 }
 
 const char *
 i2cp_destination_b64(const struct i2cp_destination_t *self)
 {
-  return self->b64;
+  char *b64;
+
+  b64 = atomic_load(&self->b64);
+  if (b64)
+    return b64;
+
+  return _destination_generate_b64((struct i2cp_destination_t *)self);
 }
@@ -0,0 +1,89 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+
+#include <i2cp/mpsc.h>
+
+void
+mpsc_init(mpsc_queue_t *self)
+{
+  atomic_store_explicit(&self->stub.next, NULL, memory_order_relaxed);
+  atomic_store_explicit(&self->head, &self->stub, memory_order_relaxed);
+  self->tail = &self->stub;
+}
+
+void
+mpsc_push(mpsc_queue_t *self, mpsc_node_t *node)
+{
+  mpsc_node_t *prev;
+
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  prev = atomic_exchange_explicit(&self->head, node, memory_order_acq_rel);
+
+  /* until linked here the node is not visible to the consumer */
+  atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+mpsc_node_t *
+mpsc_pop(mpsc_queue_t *self)
+{
+  mpsc_node_t *tail, *next;
+
+  tail = self->tail;
+  next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  /* skip the stub */
+  if (tail == &self->stub)
+  {
+    if (next == NULL)
+      return NULL;
+
+    self->tail = next;
+    tail = next;
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  }
+
+  if (next)
+  {
+    self->tail = next;
+    return tail;
+  }
+
+  /* a producer is linking a node after tail */
+  if (tail != atomic_load_explicit(&self->head, memory_order_acquire))
+    return NULL;
+
+  /* tail is the last node, push stub behind it to pop it */
+  mpsc_push(self, &self->stub);
+  next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  if (next)
+  {
+    self->tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+int
+mpsc_is_empty(mpsc_queue_t *self)
+{
+  return self->tail == &self->stub
+    && atomic_load_explicit(&self->head, memory_order_acquire) == &self->stub;
+}
@@ -0,0 +1,139 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <memory.h>
+#include <time.h>
+
+#include <i2cp/ratelimit.h>
+
+typedef struct ratelimit_t
+{
+  uint64_t rate;
+  uint64_t burst;
+  int64_t tokens;
+  /* monotonic time of last refill in microseconds */
+  uint64_t stamp;
+} ratelimit_t;
+
+static uint64_t
+_ratelimit_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+_ratelimit_refill(ratelimit_t *self)
+{
+  uint64_t now, elapsed, tokens;
+
+  now = _ratelimit_now();
+  elapsed = now - self->stamp;
+
+  /* a bucket idle for long is full, avoids overflow below */
+  if (elapsed > 10 * 1000000)
+  {
+    self->tokens = self->burst;
+    self->stamp = now;
+    return;
+  }
+
+  /* advance stamp only by the time converted into whole tokens */
+  tokens = elapsed * self->rate / 1000000;
+  if (tokens == 0)
+    return;
+
+  self->tokens += tokens;
+  self->stamp += tokens * 1000000 / self->rate;
+  if (self->tokens >= (int64_t)self->burst)
+  {
+    self->tokens = self->burst;
+    self->stamp = now;
+  }
+}
+
+struct ratelimit_t *
+ratelimit_new()
+{
+  ratelimit_t *rl;
+  rl = malloc(sizeof(ratelimit_t));
+  memset(rl, 0, sizeof(ratelimit_t));
+  return rl;
+}
+
+void
+ratelimit_destroy(struct ratelimit_t *self)
+{
+  free(self);
+}
+
+void
+ratelimit_set_rate(struct ratelimit_t *self, uint64_t rate, uint64_t burst)
+{
+  if (burst < rate)
+    burst = rate;
+
+  /* a new limit starts with a full bucket */
+  if (self->rate == 0)
+  {
+    self->tokens = burst;
+    self->stamp = _ratelimit_now();
+  }
+  else if (self->tokens > (int64_t)burst)
+    self->tokens = burst;
+
+  self->rate = rate;
+  self->burst = burst;
+}
+
+uint64_t
+ratelimit_get_rate(struct ratelimit_t *self)
+{
+  return self->rate;
+}
+
+int64_t
+ratelimit_available(struct ratelimit_t *self)
+{
+  if (self->rate == 0)
+    return INT64_MAX;
+
+  _ratelimit_refill(self);
+  return self->tokens;
+}
+
+void
+ratelimit_consume(struct ratelimit_t *self, size_t bytes)
+{
+  if (self->rate == 0)
+    return;
+
+  self->tokens -= bytes;
+}
+
+int
+ratelimit_delay(struct ratelimit_t *self)
+{
+  if (ratelimit_available(self) > 0)
+    return 0;
+
+  /* time until one token is available, rounded up */
+  return ((1 - self->tokens) * 1000 + self->rate - 1) / self->rate;
+}
@@ -19,19 +19,102 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <i2cp/i2cp.h>
+#include <i2cp/intmap.h>
+#include <i2cp/ratelimit.h>
 
 #define TAG SESSION
 
+/*
+ * External decls for private client functions.
+ */
+extern int _client_msg_send_message(struct i2cp_client_t *self, struct i2cp_session_t *session,
+				     struct i2cp_destination_t *destination,
+				     i2cp_protocol_t protocol, uint16_t src_port, uint16_t dest_port,
+				     stream_t *payload, uint32_t nonce,
+				     const i2cp_send_options_t *options, int queue);
+extern uint64_t _client_send_rate(struct i2cp_client_t *self);
+
 typedef struct i2cp_session_t
 {
   uint16_t session_id;
   struct i2cp_client_t *client;
   struct i2cp_session_config_t *config;
   i2cp_session_callbacks_t *callbacks;
+
+  /* guards stats, tracked messages and share against concurrent senders
+     and the status dispatch of io thread */
+  pthread_mutex_t lock;
+  i2cp_session_stats_t stats;
+
+  /* tracked messages waiting for status, by nonce until accepted by
+     router and then by message id */
+  struct intmap_t *inflight_nonce;
+  struct intmap_t *inflight_message;
+
+  /* paces the session to its share of the client send rate */
+  struct ratelimit_t *share;
 } i2cp_session_t;
 
+typedef struct _session_inflight_t
+{
+  uint32_t nonce;
+  uint32_t message_id;
+} _session_inflight_t;
+
+static int
+_session_tracks_status(struct i2cp_session_t *self)
+{
+  const char *value;
+
+  value = i2cp_session_config_get_property(self->config,
+					   SESSION_CONFIG_PROP_I2CP_MESSAGE_RELIABILITY);
+  return value && strcmp(value, "none") != 0;
+}
+
+static void
+_session_inflight_remove(struct i2cp_session_t *self, _session_inflight_t *msg)
+{
+  if (msg->message_id)
+    intmap_remove(self->inflight_message, msg->message_id);
+  else
+    intmap_remove(self->inflight_nonce, msg->nonce);
+
+  self->stats.messages_in_flight--;
+  free(msg);
+}
+
+/* Update rate of share from client send rate, which follows router
+   bandwidth limits and can change at any time. */
+static void
+_session_share_update(struct i2cp_session_t *self)
+{
+  uint64_t rate, share;
+
+  /* without a share the client rate isn't needed, don't take its lock */
+  share = i2cp_session_config_get_send_share(self->config);
+  if (share == 0)
+  {
+    if (ratelimit_get_rate(self->share))
+      ratelimit_set_rate(self->share, 0, 0);
+    return;
+  }
+
+  rate = _client_send_rate(self->client) * share / 100;
+  if (rate != ratelimit_get_rate(self->share))
+    ratelimit_set_rate(self->share, rate, 0);
+}
+
+static void
+_session_inflight_free(const uint32_t key, void *value, void *opaque)
+{
+  free(value);
+}
+
 
 void
 _session_dispatch_message(struct i2cp_session_t *self,
@@ -92,6 +175,59 @@ _session_dispatch_destination(struct i2cp_session_t *session, uint32_t request_i
   session->callbacks->on_destination(session, request_id,  address, destination, session->callbacks->opaque);
 }
 
+void
+_session_dispatch_message_status(struct i2cp_session_t *self, uint32_t message_id,
+				 i2cp_session_message_status_t status, uint32_t size, uint32_t nonce)
+{
+  _session_inflight_t *msg;
+
+  /* accepted messages are tracked by the message id router assigned,
+     failures before acceptance carry only the nonce */
+  pthread_mutex_lock(&self->lock);
+  msg = NULL;
+  if (message_id)
+    msg = (_session_inflight_t *)intmap_get(self->inflight_message, message_id);
+  if (msg == NULL && nonce)
+    msg = (_session_inflight_t *)intmap_get(self->inflight_nonce, nonce);
+
+  if (msg)
+  {
+    nonce = msg->nonce;
+    if (status == I2CP_MSG_STATUS_ACCEPTED)
+    {
+      if (msg->message_id == 0 && message_id)
+      {
+	intmap_remove(self->inflight_nonce, msg->nonce);
+	msg->message_id = message_id;
+	intmap_put(self->inflight_message, message_id, msg);
+      }
+    }
+    else if (status != I2CP_MSG_STATUS_AVAILABLE)
+      _session_inflight_remove(self, msg);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  if (self->callbacks == NULL)
+    return;
+
+  if (self->callbacks->on_message_status == NULL)
+    return;
+
+  self->callbacks->on_message_status(self, nonce, status, size, self->callbacks->opaque);
+}
+
+void
+_session_account_send(struct i2cp_session_t *self, int level,
+		      size_t payload_size, size_t compressed_size)
+{
+  pthread_mutex_lock(&self->lock);
+  self->stats.messages_sent++;
+  self->stats.payload_bytes_sent += payload_size;
+  self->stats.compressed_bytes_sent += compressed_size;
+  self->stats.compression_level = level;
+  pthread_mutex_unlock(&self->lock);
+}
+
 void
 _i2cp_session_set_id(struct i2cp_session_t *self, uint16_t session_id)
 {
@@ -110,12 +246,22 @@ i2cp_session_new(struct i2cp_client_t *client,
   session->client = client;
   session->config = i2cp_session_config_new(dest_fname);
   session->callbacks = callbacks;
+  pthread_mutex_init(&session->lock, NULL);
+  session->inflight_nonce = intmap_new(64);
+  session->inflight_message = intmap_new(64);
+  session->share = ratelimit_new();
   return session;
 }
 
 void
 i2cp_session_destroy(struct i2cp_session_t *self)
 {
+  intmap_foreach(self->inflight_nonce, _session_inflight_free, NULL);
+  intmap_foreach(self->inflight_message, _session_inflight_free, NULL);
+  intmap_destroy(self->inflight_nonce);
+  intmap_destroy(self->inflight_message);
+  ratelimit_destroy(self->share);
+  pthread_mutex_destroy(&self->lock);
   i2cp_session_config_destroy(self->config);
   free(self);
 }
@@ -132,15 +278,91 @@ i2cp_session_get_id(struct i2cp_session_t *self)
   return self->session_id;
 }
 
-void
+int
 i2cp_session_send_message(struct i2cp_session_t *self,
 			  const struct i2cp_destination_t *destination,
 			  i2cp_protocol_t protocol, uint16_t src_port, uint16_t dest_port,
 			  stream_t *payload, uint32_t nonce)
 {
-  _client_msg_send_message(self->client, self, destination,
-			   protocol, src_port, dest_port,
-			   payload, nonce);
+  return i2cp_session_send_message_ex(self, destination, protocol, src_port, dest_port,
+				      payload, nonce, NULL);
+}
+
+int
+i2cp_session_send_message_ex(struct i2cp_session_t *self,
+			     const struct i2cp_destination_t *destination,
+			     i2cp_protocol_t protocol, uint16_t src_port, uint16_t dest_port,
+			     stream_t *payload, uint32_t nonce,
+			     const i2cp_send_options_t *options)
+{
+  int ret;
+  uint32_t window;
+  _session_inflight_t *msg;
+
+  /* share and window are taken before the message is built, the lock is
+     not held while compressing so senders of a session run in parallel */
+  pthread_mutex_lock(&self->lock);
+  _session_share_update(self);
+  if (ratelimit_available(self->share) <= 0)
+  {
+    pthread_mutex_unlock(&self->lock);
+    errno = EAGAIN;
+    return -1;
+  }
+
+  /* track message until router reports a final status */
+  msg = NULL;
+  if (nonce && _session_tracks_status(self))
+  {
+    window = i2cp_session_config_get_send_window(self->config);
+    if (window && self->stats.messages_in_flight >= window)
+    {
+      pthread_mutex_unlock(&self->lock);
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if (intmap_get(self->inflight_nonce, nonce))
+    {
+      pthread_mutex_unlock(&self->lock);
+      warning(TAG, "Message with nonce %u is already waiting for status.", nonce);
+      errno = EEXIST;
+      return -1;
+    }
+
+    msg = malloc(sizeof(_session_inflight_t));
+    msg->nonce = nonce;
+    msg->message_id = 0;
+    intmap_put(self->inflight_nonce, nonce, msg);
+    self->stats.messages_in_flight++;
+  }
+  ratelimit_consume(self->share, stream_length(payload));
+  pthread_mutex_unlock(&self->lock);
+
+  ret = _client_msg_send_message(self->client, self, (struct i2cp_destination_t *)destination,
+				 protocol, src_port, dest_port,
+				 payload, nonce, options, 1);
+  if (ret != 0 && msg)
+  {
+    pthread_mutex_lock(&self->lock);
+    _session_inflight_remove(self, msg);
+    pthread_mutex_unlock(&self->lock);
+  }
+
+  return ret;
+}
+
+int
+i2cp_session_send_delay(struct i2cp_session_t *self)
+{
+  int ret;
+
+  pthread_mutex_lock(&self->lock);
+  _session_share_update(self);
+  ret = ratelimit_delay(self->share);
+  pthread_mutex_unlock(&self->lock);
+
+  return ret;
 }
 
 const struct i2cp_destination_t *
@@ -148,3 +370,11 @@ i2cp_session_get_destination(struct i2cp_session_t *self)
 {
   return i2cp_session_config_get_destination(self->config);
 }
+
+void
+i2cp_session_get_stats(struct i2cp_session_t *self, i2cp_session_stats_t *stats)
+{
+  pthread_mutex_lock(&self->lock);
+  *stats = self->stats;
+  pthread_mutex_unlock(&self->lock);
+}
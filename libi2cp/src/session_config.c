@@ -62,6 +62,9 @@ typedef struct i2cp_session_config_t
   const char *properties[NR_OF_SESSION_CONFIG_PROPERTIES];
   uint64_t date;
   struct i2cp_destination_t *destination;
+  int compression;
+  uint32_t send_window;
+  uint8_t send_share;
 
 } i2cp_session_config_t;
 
@@ -136,6 +139,7 @@ i2cp_session_config_t *i2cp_session_config_new(const char *dest_fname)
 
   config = malloc(sizeof(i2cp_session_config_t));
   memset(config, 0, sizeof(i2cp_session_config_t));
+  config->compression = I2CP_COMPRESSION_DEFAULT;
 
   /* if destination file specified, try load it */
   if (dest_fname != NULL)
@@ -183,6 +187,12 @@ void i2cp_session_config_set_property(struct i2cp_session_config_t *self,
   self->properties[prop] = value;
 }
 
+const char *i2cp_session_config_get_property(struct i2cp_session_config_t *self,
+					     i2cp_session_config_property_t prop)
+{
+  return self->properties[prop];
+}
+
 void i2cp_session_config_get_message(struct i2cp_session_config_t *self, stream_t *stream)
 {
   struct timeval tp;
@@ -208,3 +218,39 @@ i2cp_session_config_get_destination(struct i2cp_session_config_t *self)
 {
   return self->destination;
 }
+
+void i2cp_session_config_set_compression(struct i2cp_session_config_t *self, int level)
+{
+  if (level < I2CP_COMPRESSION_STORED || level > 9)
+  {
+    warning(TAG, "Invalid compression level %d, using default.", level);
+    level = I2CP_COMPRESSION_DEFAULT;
+  }
+
+  self->compression = level;
+}
+
+int i2cp_session_config_get_compression(struct i2cp_session_config_t *self)
+{
+  return self->compression;
+}
+
+void i2cp_session_config_set_send_window(struct i2cp_session_config_t *self, uint32_t window)
+{
+  self->send_window = window;
+}
+
+uint32_t i2cp_session_config_get_send_window(struct i2cp_session_config_t *self)
+{
+  return self->send_window;
+}
+
+void i2cp_session_config_set_send_share(struct i2cp_session_config_t *self, uint8_t percent)
+{
+  self->send_share = percent > 100 ? 100 : percent;
+}
+
+uint8_t i2cp_session_config_get_send_share(struct i2cp_session_config_t *self)
+{
+  return self->send_share;
+}
@@ -0,0 +1,113 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <i2cp/spsc.h>
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct spsc_t
+{
+  uint32_t mask;
+  void **items;
+
+  /* indexes run freely and are masked on access, the producer and
+     consumer index live on separate cache lines */
+  _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail;
+  _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head;
+} spsc_t;
+
+struct spsc_t *
+spsc_new(uint32_t size)
+{
+  spsc_t *ring;
+  uint32_t n;
+
+  n = 1;
+  while (n < size)
+    n <<= 1;
+
+  ring = aligned_alloc(SPSC_CACHE_LINE, sizeof(spsc_t));
+  memset(ring, 0, sizeof(spsc_t));
+  ring->mask = n - 1;
+  ring->items = malloc(n * sizeof(void *));
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->head, 0);
+
+  return ring;
+}
+
+void
+spsc_destroy(struct spsc_t *self)
+{
+  free(self->items);
+  free(self);
+}
+
+int
+spsc_push(struct spsc_t *self, void *item)
+{
+  uint32_t tail;
+
+  tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&self->head, memory_order_acquire) > self->mask)
+    return -1;
+
+  self->items[tail & self->mask] = item;
+  atomic_store_explicit(&self->tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+void *
+spsc_pop(struct spsc_t *self)
+{
+  void *item;
+  uint32_t head;
+
+  head = atomic_load_explicit(&self->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&self->tail, memory_order_acquire))
+    return NULL;
+
+  item = self->items[head & self->mask];
+  atomic_store_explicit(&self->head, head + 1, memory_order_release);
+  return item;
+}
+
+uint32_t
+spsc_count(struct spsc_t *self)
+{
+  return atomic_load_explicit(&self->tail, memory_order_acquire)
+    - atomic_load_explicit(&self->head, memory_order_acquire);
+}
+
+int
+spsc_is_full(struct spsc_t *self)
+{
+  return atomic_load_explicit(&self->tail, memory_order_acquire)
+    - atomic_load_explicit(&self->head, memory_order_acquire) > self->mask;
+}
+
+int
+spsc_is_empty(struct spsc_t *self)
+{
+  return atomic_load_explicit(&self->tail, memory_order_acquire)
+    == atomic_load_explicit(&self->head, memory_order_acquire);
+}
@@ -18,6 +18,10 @@
 
 #include <i2cp/config.h>
 
+#ifdef HAVE_GETADDRINFO_A
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
@@ -31,13 +35,20 @@
 #include <Winsock2.h>
 #else
 #include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #endif
 
 #ifdef WITH_GNUTLS
+#include <pthread.h>
 #include <gnutls/gnutls.h>
+#include <gnutls/x509.h>
 
 #ifndef GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT
 #define GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT ((unsigned int)-1)
@@ -45,6 +56,10 @@
 
 #endif
 
+#ifdef WITH_IO_URING
+#include <liburing.h>
+#endif
+
 #include <i2cp/logger.h>
 #include <i2cp/stream.h>
 #include <i2cp/tcp.h>
@@ -53,31 +68,480 @@
 
 #define CAFILE "/etc/ssl/certs/ca-certificates.crt"
 
+#ifdef WITH_IO_URING
+#define TCP_URING_ENTRIES 64
+#define TCP_URING_RECV_BUFFERS 32 /* power of two */
+#define TCP_URING_RECV_BUFFER_SIZE 0x4000
+#define TCP_URING_SEND_BUFFER_SIZE 0x40000
+#define TCP_URING_BUFFER_GROUP 0
+
+#define TCP_URING_OP_RECV 1
+#define TCP_URING_OP_SEND 2
+
+/* io_uring transport of a connection. Received data is delivered by a
+   multishot recv into buffers of a provided buffer ring, the filled buffers
+   are queued as chunks in order of arrival and handed back to the ring when
+   consumed. Sends are copied into a ring buffer and submitted as a chain of
+   linked sends, only one chain is in flight at a time to keep order. */
+typedef struct tcp_uring_t
+{
+  struct io_uring ring;
+
+  struct io_uring_buf_ring *buf_ring;
+  uint8_t *recv_buffers;
+  int recv_armed;
+  int recv_eof;
+  int recv_error;
+
+  /* received chunks, chunk_count starting at chunk_head */
+  struct {
+    uint16_t bid;
+    uint32_t offset;
+    uint32_t length;
+  } chunks[TCP_URING_RECV_BUFFERS];
+  int chunk_head;
+  int chunk_count;
+
+  /* send ring buffer, send_head..send_tail is not yet confirmed sent */
+  uint8_t *send_buffer;
+  uint64_t send_head;
+  uint64_t send_tail;
+  int send_inflight;
+  int send_error;
+} tcp_uring_t;
+#endif
+
 typedef struct tcp_t
 {
   int socket;
+  tcp_state_t state;
+
+  /* resolved addresses and the one currently connecting */
   struct addrinfo *server;
+  struct addrinfo *addr;
+  struct addrinfo hints;
+
+  /* address of a unix domain socket connect */
+  struct addrinfo unix_addrinfo;
+  struct sockaddr_un unix_addr;
+
+#ifdef HAVE_GETADDRINFO_A
+  struct gaicb gai;
+  struct gaicb *gai_list[1];
+#endif
 
 #ifdef WITH_GNUTLS
   gnutls_session_t session;
-  gnutls_certificate_credentials_t creds;
+  int send_flags;
+  int recv_flags;
+  int tls_flush_pending;
+  int tls_active;
+
+  /* session data of last connection used to resume on reconnect */
+  gnutls_datum_t tls_resume;
+
+  /* DER of pinned router certificate loaded from tls_pinned_file */
+  gnutls_datum_t tls_pinned;
+  char *tls_pinned_file;
+#endif
+
+#ifdef WITH_IO_URING
+  /* io_uring transport, NULL if socket is used directly */
+  tcp_uring_t *uring;
 #endif
 
   const char *properties[NR_OF_TCP_PROPERTIES];
   
 } tcp_t;
 
+#ifdef WITH_IO_URING
+static struct io_uring_sqe *
+_tcp_uring_get_sqe(tcp_uring_t *u)
+{
+  struct io_uring_sqe *sqe;
+
+  /* submit queued entries to make room if submission queue is full */
+  sqe = io_uring_get_sqe(&u->ring);
+  if (sqe == NULL)
+  {
+    io_uring_submit(&u->ring);
+    sqe = io_uring_get_sqe(&u->ring);
+  }
+
+  return sqe;
+}
+
+static void
+_tcp_uring_recv_arm(struct tcp_t *self)
+{
+  tcp_uring_t *u;
+  struct io_uring_sqe *sqe;
+
+  u = self->uring;
+  sqe = _tcp_uring_get_sqe(u);
+  if (sqe == NULL)
+    return;
+
+  io_uring_prep_recv_multishot(sqe, self->socket, NULL, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = TCP_URING_BUFFER_GROUP;
+  io_uring_sqe_set_data64(sqe, TCP_URING_OP_RECV);
+  u->recv_armed = 1;
+}
+
+static void
+_tcp_uring_recycle(tcp_uring_t *u, uint16_t bid)
+{
+  io_uring_buf_ring_add(u->buf_ring, u->recv_buffers + bid * TCP_URING_RECV_BUFFER_SIZE,
+			TCP_URING_RECV_BUFFER_SIZE, bid,
+			io_uring_buf_ring_mask(TCP_URING_RECV_BUFFERS), 0);
+  io_uring_buf_ring_advance(u->buf_ring, 1);
+}
+
+/* Submit the queued send data as linked sends, the ring buffer wraps so
+   the chain is at most two entries. */
+static void
+_tcp_uring_send_submit(struct tcp_t *self)
+{
+  size_t offset, length;
+  uint64_t pos;
+  tcp_uring_t *u;
+  struct io_uring_sqe *sqe, *last;
+
+  u = self->uring;
+  if (u->send_inflight || u->send_head == u->send_tail || u->send_error)
+    return;
+
+  last = NULL;
+  for (pos = u->send_head; pos < u->send_tail; pos += length)
+  {
+    offset = pos % TCP_URING_SEND_BUFFER_SIZE;
+    length = u->send_tail - pos;
+    if (length > TCP_URING_SEND_BUFFER_SIZE - offset)
+      length = TCP_URING_SEND_BUFFER_SIZE - offset;
+
+    sqe = _tcp_uring_get_sqe(u);
+    if (sqe == NULL)
+      break;
+
+    /* a short send fails the link so nothing is sent out of order */
+    io_uring_prep_send(sqe, self->socket, u->send_buffer + offset, length,
+		       MSG_NOSIGNAL | MSG_WAITALL);
+    io_uring_sqe_set_data64(sqe, TCP_URING_OP_SEND);
+    sqe->flags |= IOSQE_IO_LINK;
+    u->send_inflight++;
+    last = sqe;
+  }
+
+  if (last)
+    last->flags &= ~IOSQE_IO_LINK;
+}
+
+/* Process all available completions, then rearm receive and submit the
+   next send chain if needed. */
+static void
+_tcp_uring_reap(struct tcp_t *self)
+{
+  int idx;
+  unsigned head, count;
+  tcp_uring_t *u;
+  struct io_uring_cqe *cqe;
+
+  u = self->uring;
+  count = 0;
+  io_uring_for_each_cqe(&u->ring, head, cqe)
+  {
+    count++;
+    if (io_uring_cqe_get_data64(cqe) == TCP_URING_OP_RECV)
+    {
+      if (!(cqe->flags & IORING_CQE_F_MORE))
+	u->recv_armed = 0;
+
+      if (cqe->res > 0)
+      {
+	idx = (u->chunk_head + u->chunk_count) % TCP_URING_RECV_BUFFERS;
+	u->chunks[idx].bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	u->chunks[idx].offset = 0;
+	u->chunks[idx].length = cqe->res;
+	u->chunk_count++;
+      }
+      else if (cqe->res == 0)
+	u->recv_eof = 1;
+      else if (cqe->res != -ENOBUFS && cqe->res != -EAGAIN && cqe->res != -EINTR)
+	u->recv_error = -cqe->res;
+    }
+    else
+    {
+      u->send_inflight--;
+      if (cqe->res > 0)
+	u->send_head += cqe->res;
+      else if (cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -EAGAIN && cqe->res != -EINTR)
+	u->send_error = -cqe->res;
+    }
+  }
+  io_uring_cq_advance(&u->ring, count);
+
+  /* multishot recv ends when out of buffers, rearm when there is a free one */
+  if (!u->recv_armed && !u->recv_eof && !u->recv_error && u->chunk_count < TCP_URING_RECV_BUFFERS)
+    _tcp_uring_recv_arm(self);
+
+  _tcp_uring_send_submit(self);
+  io_uring_submit(&u->ring);
+}
+
+static int
+_tcp_uring_wait(struct tcp_t *self)
+{
+  int ret;
+  struct io_uring_cqe *cqe;
+
+  ret = io_uring_wait_cqe(&self->uring->ring, &cqe);
+  if (ret < 0 && ret != -EINTR)
+  {
+    errno = -ret;
+    return -1;
+  }
+
+  _tcp_uring_reap(self);
+  return 0;
+}
+
+/* Receive from queued chunks, same semantics as recv() */
+static ssize_t
+_tcp_uring_recv(struct tcp_t *self, void *data, size_t len, int nonblock)
+{
+  size_t n, total;
+  tcp_uring_t *u;
+
+  u = self->uring;
+  _tcp_uring_reap(self);
+
+  while (u->chunk_count == 0)
+  {
+    if (u->recv_eof)
+      return 0;
+
+    if (u->recv_error)
+    {
+      errno = u->recv_error;
+      return -1;
+    }
+
+    if (nonblock)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    if (_tcp_uring_wait(self) < 0)
+      return -1;
+  }
+
+  total = 0;
+  while (total < len && u->chunk_count)
+  {
+    n = u->chunks[u->chunk_head].length - u->chunks[u->chunk_head].offset;
+    if (n > len - total)
+      n = len - total;
+
+    memcpy((uint8_t *)data + total,
+	   u->recv_buffers + u->chunks[u->chunk_head].bid * TCP_URING_RECV_BUFFER_SIZE
+	   + u->chunks[u->chunk_head].offset, n);
+    total += n;
+
+    u->chunks[u->chunk_head].offset += n;
+    if (u->chunks[u->chunk_head].offset == u->chunks[u->chunk_head].length)
+    {
+      _tcp_uring_recycle(u, u->chunks[u->chunk_head].bid);
+      u->chunk_head = (u->chunk_head + 1) % TCP_URING_RECV_BUFFERS;
+      u->chunk_count--;
+    }
+  }
+
+  return total;
+}
+
+/* Copy vector into send ring buffer and submit, a non blocking send only
+   takes what fits into the ring buffer. Same semantics as sendmsg(). */
+static ssize_t
+_tcp_uring_send(struct tcp_t *self, const struct iovec *iov, int iovcnt, int nonblock)
+{
+  int i;
+  size_t n, done, offset, space, total;
+  tcp_uring_t *u;
+
+  u = self->uring;
+  _tcp_uring_reap(self);
+
+  total = 0;
+  for (i = 0; i < iovcnt; i++)
+  {
+    done = 0;
+    while (done < iov[i].iov_len)
+    {
+      if (u->send_error)
+      {
+	errno = u->send_error;
+	return total ? (ssize_t)total : -1;
+      }
+
+      space = TCP_URING_SEND_BUFFER_SIZE - (u->send_tail - u->send_head);
+      if (space == 0)
+      {
+	if (nonblock)
+	  goto out;
+
+	/* wait for the chain in flight to free space */
+	_tcp_uring_send_submit(self);
+	io_uring_submit(&u->ring);
+	if (_tcp_uring_wait(self) < 0)
+	  return total ? (ssize_t)total : -1;
+	continue;
+      }
+
+      offset = u->send_tail % TCP_URING_SEND_BUFFER_SIZE;
+      n = iov[i].iov_len - done;
+      if (n > space)
+	n = space;
+      if (n > TCP_URING_SEND_BUFFER_SIZE - offset)
+	n = TCP_URING_SEND_BUFFER_SIZE - offset;
+
+      memcpy(u->send_buffer + offset, (uint8_t *)iov[i].iov_base + done, n);
+      u->send_tail += n;
+      done += n;
+      total += n;
+    }
+  }
+
+ out:
+  _tcp_uring_send_submit(self);
+  io_uring_submit(&u->ring);
+
+  if (total == 0 && nonblock)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  return total;
+}
+
+static void
+_tcp_uring_stop(struct tcp_t *self, int graceful)
+{
+  tcp_uring_t *u;
+
+  u = self->uring;
+  if (u == NULL)
+    return;
+
+  /* let sends in flight finish before the socket is shutdown */
+  while (graceful && u->send_head != u->send_tail && !u->send_error)
+  {
+    _tcp_uring_send_submit(self);
+    io_uring_submit(&u->ring);
+    if (_tcp_uring_wait(self) < 0)
+      break;
+  }
+
+  if (u->buf_ring)
+    io_uring_free_buf_ring(&u->ring, u->buf_ring, TCP_URING_RECV_BUFFERS, TCP_URING_BUFFER_GROUP);
+  io_uring_queue_exit(&u->ring);
+
+  free(u->recv_buffers);
+  free(u->send_buffer);
+  free(u);
+  self->uring = NULL;
+}
+
+/* Setup io_uring transport for connected socket, on failure the socket is
+   used directly. */
+static void
+_tcp_uring_start(struct tcp_t *self)
+{
+  int ret, i;
+  tcp_uring_t *u;
+
+  u = malloc(sizeof(tcp_uring_t));
+  if (u == NULL)
+    return;
+  memset(u, 0, sizeof(tcp_uring_t));
+
+  ret = io_uring_queue_init(TCP_URING_ENTRIES, &u->ring, 0);
+  if (ret < 0)
+  {
+    warning(TAG, "failed to setup io_uring with reason; %s", strerror(-ret));
+    free(u);
+    return;
+  }
+
+  self->uring = u;
+
+  u->buf_ring = io_uring_setup_buf_ring(&u->ring, TCP_URING_RECV_BUFFERS, TCP_URING_BUFFER_GROUP, 0, &ret);
+  u->recv_buffers = malloc(TCP_URING_RECV_BUFFERS * TCP_URING_RECV_BUFFER_SIZE);
+  u->send_buffer = malloc(TCP_URING_SEND_BUFFER_SIZE);
+  if (u->buf_ring == NULL || u->recv_buffers == NULL || u->send_buffer == NULL)
+  {
+    warning(TAG, "failed to setup io_uring buffers with reason; %s",
+	    u->buf_ring == NULL ? strerror(-ret) : "out of memory");
+    _tcp_uring_stop(self, 0);
+    return;
+  }
+
+  for (i = 0; i < TCP_URING_RECV_BUFFERS; i++)
+    _tcp_uring_recycle(u, i);
+
+  _tcp_uring_recv_arm(self);
+  io_uring_submit(&u->ring);
+
+  debug(TAG, "context %p using io_uring transport", (void *)self);
+}
+#endif // WITH_IO_URING
+
 #ifdef WITH_GNUTLS
+/* Credentials are shared by all connections using the same CA file so the
+   CA bundle is parsed once per process, they are freed by tcp_deinit(). */
+typedef struct _tcp_tls_creds_t
+{
+  char *ca_file;
+  gnutls_certificate_credentials_t creds;
+  struct _tcp_tls_creds_t *next;
+} _tcp_tls_creds_t;
+
+static _tcp_tls_creds_t *_tcp_tls_creds = NULL;
+static pthread_mutex_t _tcp_tls_creds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Verify router certificate against the pinned certificate if one is set,
+   otherwise against the trusted CAs of the credentials. */
 static int
 _verify_certificate_callback(gnutls_session_t session)
 {
-  unsigned int status;
+  unsigned int status, count;
   int ret, type;
+  tcp_t *self;
   const char *hostname;
+  const gnutls_datum_t *peers;
   gnutls_datum_t out;
 
-  /* read hostname */
-  hostname = gnutls_session_get_ptr(session);
+  self = gnutls_session_get_ptr(session);
+
+  if (self->tls_pinned.size)
+  {
+    peers = gnutls_certificate_get_peers(session, &count);
+    if (peers == NULL || count == 0
+	|| peers[0].size != self->tls_pinned.size
+	|| memcmp(peers[0].data, self->tls_pinned.data, peers[0].size) != 0)
+    {
+      error(TAG, "router certificate doesn't match pinned certificate %s.", self->tls_pinned_file);
+      return GNUTLS_E_CERTIFICATE_ERROR;
+    }
+
+    info(TAG, "%s", "router certificate matches pinned certificate.");
+    return 0;
+  }
+
+  /* hostname is not verified */
+  hostname = NULL;
 
   /* This verification function uses the trusted CAs in the credentials
    * structure. So you must have installed one or more CA certificates.
@@ -97,20 +561,205 @@ _verify_certificate_callback(gnutls_session_t session)
     return GNUTLS_E_CERTIFICATE_ERROR;
   }
 
-  /* Certificate is not trusted */
+  /* Certificate is not trusted, rejected only if CAs were configured
+     explicitly as routers present self signed certificates */
   if (status != 0)
   {
+    if (self->properties[TCP_PROP_TLS_CA_FILE])
+    {
+      error(TAG, "%s", out.data);
+      gnutls_free(out.data);
+      return GNUTLS_E_CERTIFICATE_ERROR;
+    }
+
     warning(TAG, "%s", out.data);
-    status = 0;
+    gnutls_free(out.data);
+    return 0;
+  }
+
+  info(TAG, "%s", out.data);
+  gnutls_free(out.data);
+
+  return 0;
+}
+
+/* Get the shared credentials trusting the CAs of ca_file, or no CAs if
+   ca_file is NULL as used with a pinned certificate. */
+static gnutls_certificate_credentials_t
+_tcp_tls_get_creds(const char *ca_file)
+{
+  int ret;
+  _tcp_tls_creds_t *item;
+
+  pthread_mutex_lock(&_tcp_tls_creds_lock);
+
+  for (item = _tcp_tls_creds; item; item = item->next)
+    if ((item->ca_file == NULL && ca_file == NULL)
+	|| (item->ca_file && ca_file && strcmp(item->ca_file, ca_file) == 0))
+      break;
+
+  if (item == NULL)
+  {
+    item = malloc(sizeof(_tcp_tls_creds_t));
+    item->ca_file = ca_file ? strdup(ca_file) : NULL;
+    gnutls_certificate_allocate_credentials(&item->creds);
+    gnutls_certificate_set_verify_function(item->creds, _verify_certificate_callback);
+
+    if (ca_file)
+    {
+      ret = gnutls_certificate_set_x509_trust_file(item->creds, ca_file, GNUTLS_X509_FMT_PEM);
+      if (ret < 0)
+      {
+	warning(TAG, "failed to load CA file %s with reason; %s", ca_file, gnutls_strerror(ret));
+      }
+      else
+      {
+	debug(TAG, "loaded %d certificates from CA file %s", ret, ca_file);
+      }
+    }
+
+#if 0
+    /* setup x509 client certificate */
+    gnutls_certificate_set_x509_key_file (item->creds,"cert.pem", "key.pem", GNUTLS_X509_FMT_PEM);
+#endif
+
+    item->next = _tcp_tls_creds;
+    _tcp_tls_creds = item;
   }
+
+  pthread_mutex_unlock(&_tcp_tls_creds_lock);
+
+  return item->creds;
+}
+
+static void
+_tcp_tls_free_creds()
+{
+  _tcp_tls_creds_t *item;
+
+  pthread_mutex_lock(&_tcp_tls_creds_lock);
+  while (_tcp_tls_creds)
+  {
+    item = _tcp_tls_creds;
+    _tcp_tls_creds = item->next;
+    gnutls_certificate_free_credentials(item->creds);
+    free(item->ca_file);
+    free(item);
+  }
+  pthread_mutex_unlock(&_tcp_tls_creds_lock);
+}
+
+/* Load pinned router certificate as DER, the file is read once and
+   reloaded only if the property changes. */
+static int
+_tcp_tls_load_pinned(struct tcp_t *self, const char *filename)
+{
+  int ret;
+  gnutls_datum_t pem;
+  gnutls_x509_crt_t crt;
+
+  if (self->tls_pinned_file && strcmp(self->tls_pinned_file, filename) == 0)
+    return 0;
+
+  free(self->tls_pinned_file);
+  self->tls_pinned_file = NULL;
+  gnutls_free(self->tls_pinned.data);
+  self->tls_pinned.data = NULL;
+  self->tls_pinned.size = 0;
+
+  ret = gnutls_load_file(filename, &pem);
+  if (ret < 0)
+  {
+    error(TAG, "failed to load pinned certificate %s with reason; %s", filename, gnutls_strerror(ret));
+    return -1;
+  }
+
+  gnutls_x509_crt_init(&crt);
+  ret = gnutls_x509_crt_import(crt, &pem, GNUTLS_X509_FMT_PEM);
+  if (ret == 0)
+    ret = gnutls_x509_crt_export2(crt, GNUTLS_X509_FMT_DER, &self->tls_pinned);
+  gnutls_x509_crt_deinit(crt);
+  gnutls_free(pem.data);
+
+  if (ret < 0)
+  {
+    error(TAG, "failed to read pinned certificate %s with reason; %s", filename, gnutls_strerror(ret));
+    return -1;
+  }
+
+  self->tls_pinned_file = strdup(filename);
+  return 0;
+}
+
+/* gnutls push function, lets sends be non blocking on a blocking socket */
+static ssize_t
+_tcp_tls_push(gnutls_transport_ptr_t ptr, const void *data, size_t len)
+{
+  ssize_t ret;
+  tcp_t *self;
+
+  self = (tcp_t *)ptr;
+#ifdef WITH_IO_URING
+  if (self->uring)
+  {
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    ret = _tcp_uring_send(self, &iov, 1, self->send_flags & MSG_DONTWAIT);
+  }
+  else
+#endif
+    ret = send(self->socket, data, len, MSG_NOSIGNAL | self->send_flags);
+  if (ret < 0)
+    gnutls_transport_set_errno(self->session, errno);
+
+  return ret;
+}
+
+static ssize_t
+_tcp_tls_pull(gnutls_transport_ptr_t ptr, void *data, size_t len)
+{
+  ssize_t ret;
+  tcp_t *self;
+
+  self = (tcp_t *)ptr;
+#ifdef WITH_IO_URING
+  if (self->uring)
+    ret = _tcp_uring_recv(self, data, len, self->recv_flags & MSG_DONTWAIT);
   else
+#endif
+    ret = recv(self->socket, data, len, self->recv_flags);
+  if (ret < 0)
+    gnutls_transport_set_errno(self->session, errno);
+
+  return ret;
+}
+
+/* gnutls pull timeout function used while the handshake timeout is set, the
+   handshake is non blocking so this never waits and reports EAGAIN when
+   there is nothing to read */
+static int
+_tcp_tls_pull_timeout(gnutls_transport_ptr_t ptr, unsigned int ms)
+{
+  int ret;
+  tcp_t *self;
+  struct pollfd pfd;
+
+  self = (tcp_t *)ptr;
+  pfd.fd = self->socket;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  ret = poll(&pfd, 1, 0);
+  if (ret == 0)
   {
-    info(TAG, "%s", out.data);
+    gnutls_transport_set_errno(self->session, EAGAIN);
+    return -1;
   }
 
-  gnutls_free(out.data);
+  if (ret < 0)
+    gnutls_transport_set_errno(self->session, errno);
 
-  return status;
+  return ret;
 }
 #endif // WITH_GNUTLS
 
@@ -138,6 +787,7 @@ void tcp_deinit()
 #endif
 
 #ifdef WITH_GNUTLS
+  _tcp_tls_free_creds();
   gnutls_global_deinit();
 #endif
 }
@@ -160,8 +810,13 @@ void tcp_destroy(struct tcp_t *self)
 {  
   debug(TAG, "destroy context %p", (void *)self);
 
-  if (tcp_is_connected(self))
-    tcp_disconnect(self);
+  tcp_disconnect(self);
+
+#ifdef WITH_GNUTLS
+  gnutls_free(self->tls_resume.data);
+  gnutls_free(self->tls_pinned.data);
+  free(self->tls_pinned_file);
+#endif
 
   free(self);
 }
@@ -169,6 +824,16 @@ void tcp_destroy(struct tcp_t *self)
 void tcp_set_property(struct tcp_t *self, tcp_property_t prop, const char *value)
 {
   self->properties[prop] = value;
+
+#ifdef WITH_GNUTLS
+  /* session of another router can't be resumed */
+  if (prop == TCP_PROP_ADDRESS || prop == TCP_PROP_PORT || prop == TCP_PROP_UNIX_PATH)
+  {
+    gnutls_free(self->tls_resume.data);
+    self->tls_resume.data = NULL;
+    self->tls_resume.size = 0;
+  }
+#endif
 }
 
 const char * tcp_get_property(struct tcp_t *self, tcp_property_t prop)
@@ -176,102 +841,478 @@ const char * tcp_get_property(struct tcp_t *self, tcp_property_t prop)
   return self->properties[prop];
 }
 
-void tcp_connect(struct tcp_t *self)
+/* Close socket and release connection resources, a graceful close ends
+   the TLS session with the peer before the socket is shutdown. */
+static void
+_tcp_close(struct tcp_t *self, int graceful)
 {
-  int ret;
- 
-  if (tcp_is_connected(self))
+#ifdef HAVE_GETADDRINFO_A
+  if (self->state == TCP_STATE_RESOLVING)
   {
-    info(TAG, "context %p is already connected to a socket", (void *)self);
-    return;
+    if (gai_cancel(&self->gai) == EAI_NOTCANCELED)
+      gai_suspend((const struct gaicb * const *)self->gai_list, 1, NULL);
+    if (self->gai.ar_result)
+      freeaddrinfo(self->gai.ar_result);
+    self->gai.ar_result = NULL;
   }
+#endif
 
-  debug(TAG, "context %p connect", (void *)self);
+#ifdef WITH_GNUTLS
+  if (self->tls_active)
+  {
+    /* keep session data for resuming on reconnect, with TLS 1.3 the
+       session ticket is received after the handshake */
+    if (self->state == TCP_STATE_CONNECTED)
+    {
+      gnutls_free(self->tls_resume.data);
+      self->tls_resume.data = NULL;
+      self->tls_resume.size = 0;
+      gnutls_session_get_data2(self->session, &self->tls_resume);
+    }
 
-  /* create socket and setup addr */
-  if (getaddrinfo(self->properties[TCP_PROP_ADDRESS], self->properties[TCP_PROP_PORT], NULL, &self->server) != 0)
+    if (graceful && self->state == TCP_STATE_CONNECTED)
+      gnutls_bye(self->session, GNUTLS_SHUT_RDWR);
+    gnutls_deinit(self->session);
+    self->tls_active = 0;
+    self->tls_flush_pending = 0;
+  }
+#endif
+
+#ifdef WITH_IO_URING
+  _tcp_uring_stop(self, graceful);
+#endif
+
+  if (self->socket >= 0)
   {
-    error(TAG, "failed to lookup hostname %s with reason; %s",
-	  self->properties[TCP_PROP_ADDRESS], strerror(errno));
-    return;
+    if (graceful)
+      shutdown(self->socket, SHUT_RDWR);
+    close(self->socket);
   }
+  self->socket = -1;
+
+  if (self->server)
+    freeaddrinfo(self->server);
+  self->server = NULL;
+  self->addr = NULL;
+
+  self->state = TCP_STATE_DISCONNECTED;
+}
 
-  self->socket = socket(self->server->ai_family, self->server->ai_socktype, self->server->ai_protocol);
-  if (self->socket < 0)
-    error(TAG, "%s", "failed to create socket.");
+static void
+_tcp_set_nonblock(int fd, int nonblock)
+{
+  int flags;
+
+  flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+    return;
+
+  fcntl(fd, F_SETFL, nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+/* Connection is fully setup, the socket is put back into blocking mode and
+   non blocking operations are done per call. */
+static void
+_tcp_established(struct tcp_t *self)
+{
+  _tcp_set_nonblock(self->socket, 0);
+
+#ifdef WITH_IO_URING
+  if (self->properties[TCP_PROP_USE_IO_URING] && atoi(self->properties[TCP_PROP_USE_IO_URING]) == 1)
+    _tcp_uring_start(self);
+#endif
+
+  self->state = TCP_STATE_CONNECTED;
+  debug(TAG, "context %p connected", (void *)self);
+}
+
+#ifdef WITH_GNUTLS
+/* Advance the TLS handshake, returns without blocking if the handshake needs
+   more data from peer or can't flush its records. */
+static void
+_tcp_tls_handshake(struct tcp_t *self)
+{
+  int ret;
+  char *desc;
+
+  ret = gnutls_handshake(self->session);
+  if (ret < 0 && gnutls_error_is_fatal(ret) == 0)
+    return;
 
-  /* connect */
-  ret = connect(self->socket, self->server->ai_addr, self->server->ai_addrlen);
   if (ret < 0)
   {
-    error(TAG, "failed to connect to host '%s' with reason; %s",
-	  self->properties[TCP_PROP_ADDRESS], strerror(errno));
-    close(self->socket);
-    self->socket = 0;
+    error(TAG, "TLS handshake failed with reason; %s" , gnutls_strerror(ret));
+    _tcp_close(self, 0);
     return;
   }
 
-  /* setup TLS if used */
+  desc = gnutls_session_get_desc(self->session);
+  info(TAG, "TLS session info: %s%s", desc,
+       gnutls_session_is_resumed(self->session) ? " (resumed)" : "");
+  gnutls_free(desc);
+
+  _tcp_established(self);
+}
+
+static void
+_tcp_tls_start(struct tcp_t *self)
+{
+  const char *ca_file;
+
+  /* setup x509 parts, a pinned certificate replaces the CA verification */
+  ca_file = self->properties[TCP_PROP_TLS_CA_FILE] ? self->properties[TCP_PROP_TLS_CA_FILE] : CAFILE;
+  if (self->properties[TCP_PROP_TLS_PINNED_CERTIFICATE] && self->properties[TCP_PROP_TLS_PINNED_CERTIFICATE][0])
+  {
+    if (_tcp_tls_load_pinned(self, self->properties[TCP_PROP_TLS_PINNED_CERTIFICATE]) < 0)
+    {
+      _tcp_close(self, 0);
+      return;
+    }
+    ca_file = NULL;
+  }
+
+  gnutls_init (&self->session, GNUTLS_CLIENT);
+  self->tls_active = 1;
+
+  gnutls_priority_set_direct (self->session, "NORMAL", NULL);
+  gnutls_credentials_set(self->session, GNUTLS_CRD_CERTIFICATE, _tcp_tls_get_creds(ca_file));
+  gnutls_session_set_ptr(self->session, self);
+
+  /* resume session of previous connection */
+  if (self->tls_resume.size)
+    gnutls_session_set_data(self->session, self->tls_resume.data, self->tls_resume.size);
+
+  self->send_flags = 0;
+  self->recv_flags = 0;
+  self->tls_flush_pending = 0;
+  gnutls_transport_set_ptr(self->session, self);
+  gnutls_transport_set_push_function(self->session, _tcp_tls_push);
+  gnutls_transport_set_pull_function(self->session, _tcp_tls_pull);
+  gnutls_transport_set_pull_timeout_function(self->session, _tcp_tls_pull_timeout);
+  gnutls_handshake_set_timeout(self->session, GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT);
+
+  self->state = TCP_STATE_TLS_HANDSHAKE;
+  _tcp_tls_handshake(self);
+}
+#endif
+
+/* socket is connected to peer, continue with TLS handshake if used */
+static void
+_tcp_connected(struct tcp_t *self)
+{
+  /* resolved addresses are no longer needed */
+  if (self->server)
+    freeaddrinfo(self->server);
+  self->server = NULL;
+  self->addr = NULL;
+
 #ifdef WITH_GNUTLS
   if (self->properties[TCP_PROP_USE_TLS] && atoi(self->properties[TCP_PROP_USE_TLS]) == 1)
   {
+    _tcp_tls_start(self);
+    return;
+  }
+#endif
 
-    /* setup x509 parts */
-    gnutls_certificate_allocate_credentials (&self->creds);
-    gnutls_certificate_set_x509_trust_file(self->creds, CAFILE, GNUTLS_X509_FMT_PEM);
-    gnutls_certificate_set_verify_function(self->creds, _verify_certificate_callback);
+  _tcp_established(self);
+}
 
-#if 0
-    /* setup x509 client certificate */
-    gnutls_certificate_set_x509_key_file (self->creds,"cert.pem", "key.pem", GNUTLS_X509_FMT_PEM);
-#endif
+/* Start a non blocking connect to the current address, moving on to the
+   next resolved address for each one failing immediately. */
+static void
+_tcp_connect_addr(struct tcp_t *self)
+{
+  int ret;
 
-    gnutls_init (&self->session, GNUTLS_CLIENT);
+  for (; self->addr; self->addr = self->addr->ai_next)
+  {
+    self->socket = socket(self->addr->ai_family, self->addr->ai_socktype, self->addr->ai_protocol);
+    if (self->socket < 0)
+    {
+      warning(TAG, "failed to create socket with reason; %s", strerror(errno));
+      continue;
+    }
 
-    gnutls_priority_set_direct (self->session, "NORMAL", NULL);
-    gnutls_credentials_set(self->session, GNUTLS_CRD_CERTIFICATE, self->creds);
+    _tcp_set_nonblock(self->socket, 1);
 
-    gnutls_transport_set_int(self->session, self->socket);
-    gnutls_handshake_set_timeout(self->session, GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT);
-    do {
-      ret = gnutls_handshake(self->session);
-    } while(ret < 0 && gnutls_error_is_fatal(ret) == 0);
+    ret = connect(self->socket, self->addr->ai_addr, self->addr->ai_addrlen);
+    if (ret == 0)
+    {
+      _tcp_connected(self);
+      return;
+    }
 
-    if (ret < 0)
+    if (errno == EINPROGRESS)
     {
-      gnutls_deinit(self->session);
-      error(TAG, "TLS handshake failed with reason; %s" , gnutls_strerror(ret));
-      close(self->socket);
-      self->socket = 0;
+      self->state = TCP_STATE_CONNECTING;
       return;
     }
 
-    char *desc = gnutls_session_get_desc(self->session);
-    info(TAG, "TLS session info: %s", desc);
-    gnutls_free(desc);
+    warning(TAG, "failed to connect to host '%s' with reason; %s",
+	    self->properties[TCP_PROP_ADDRESS], strerror(errno));
+    close(self->socket);
+    self->socket = -1;
+  }
+
+  error(TAG, "failed to connect to host '%s'", self->properties[TCP_PROP_ADDRESS]);
+  _tcp_close(self, 0);
+}
+
+/* unix domain socket path from TCP_PROP_UNIX_PATH or an address of the
+   form unix:/path, NULL if connecting over tcp. */
+static const char *
+_tcp_unix_path(struct tcp_t *self)
+{
+  const char *address;
+
+  if (self->properties[TCP_PROP_UNIX_PATH] && self->properties[TCP_PROP_UNIX_PATH][0])
+    return self->properties[TCP_PROP_UNIX_PATH];
+
+  address = self->properties[TCP_PROP_ADDRESS];
+  if (address && strncmp(address, "unix:", 5) == 0)
+    return address + 5;
+
+  return NULL;
+}
+
+/* setup a single address to connect for the unix domain socket */
+static int
+_tcp_unix_addr(struct tcp_t *self)
+{
+  const char *path;
+
+  path = _tcp_unix_path(self);
+  if (strlen(path) >= sizeof(self->unix_addr.sun_path))
+  {
+    error(TAG, "unix socket path '%s' is too long", path);
+    return -1;
+  }
+
+  memset(&self->unix_addr, 0, sizeof(struct sockaddr_un));
+  self->unix_addr.sun_family = AF_UNIX;
+  strncpy(self->unix_addr.sun_path, path, sizeof(self->unix_addr.sun_path) - 1);
+
+  memset(&self->unix_addrinfo, 0, sizeof(struct addrinfo));
+  self->unix_addrinfo.ai_family = AF_UNIX;
+  self->unix_addrinfo.ai_socktype = SOCK_STREAM;
+  self->unix_addrinfo.ai_addr = (struct sockaddr *)&self->unix_addr;
+  self->unix_addrinfo.ai_addrlen = sizeof(struct sockaddr_un);
+
+  self->server = NULL;
+  self->addr = &self->unix_addrinfo;
+  return 0;
+}
+
+void tcp_connect_start(struct tcp_t *self)
+{
+  int ret;
+  struct addrinfo *hints;
+
+  if (self->state != TCP_STATE_DISCONNECTED)
+  {
+    info(TAG, "context %p is already connected to a socket", (void *)self);
+    return;
   }
+
+  /* release what is left of a connection closed by peer */
+  _tcp_close(self, 0);
+
+  debug(TAG, "context %p connect", (void *)self);
+
+  /* local router on a unix domain socket */
+  if (_tcp_unix_path(self))
+  {
+    if (_tcp_unix_addr(self) == 0)
+      _tcp_connect_addr(self);
+    return;
+  }
+
+  hints = &self->hints;
+  memset(hints, 0, sizeof(struct addrinfo));
+  hints->ai_family = AF_UNSPEC;
+  hints->ai_socktype = SOCK_STREAM;
+
+  /* numeric addresses are resolved without a lookup */
+  hints->ai_flags = AI_NUMERICHOST;
+  if (getaddrinfo(self->properties[TCP_PROP_ADDRESS], self->properties[TCP_PROP_PORT],
+		  hints, &self->server) == 0)
+  {
+    self->addr = self->server;
+    _tcp_connect_addr(self);
+    return;
+  }
+  hints->ai_flags = 0;
+
+#ifdef HAVE_GETADDRINFO_A
+  /* lookup hostname in background and continue when resolved */
+  memset(&self->gai, 0, sizeof(struct gaicb));
+  self->gai.ar_name = self->properties[TCP_PROP_ADDRESS];
+  self->gai.ar_service = self->properties[TCP_PROP_PORT];
+  self->gai.ar_request = hints;
+  self->gai_list[0] = &self->gai;
+  ret = getaddrinfo_a(GAI_NOWAIT, self->gai_list, 1, NULL);
+  if (ret == 0)
+  {
+    self->state = TCP_STATE_RESOLVING;
+    return;
+  }
+  warning(TAG, "failed to start lookup of hostname %s with reason; %s",
+	  self->properties[TCP_PROP_ADDRESS], gai_strerror(ret));
 #endif
 
+  ret = getaddrinfo(self->properties[TCP_PROP_ADDRESS], self->properties[TCP_PROP_PORT],
+		    hints, &self->server);
+  if (ret != 0)
+  {
+    error(TAG, "failed to lookup hostname %s with reason; %s",
+	  self->properties[TCP_PROP_ADDRESS], gai_strerror(ret));
+    self->server = NULL;
+    return;
+  }
+
+  self->addr = self->server;
+  _tcp_connect_addr(self);
 }
 
-void tcp_disconnect(struct tcp_t *self)
+tcp_state_t tcp_connect_continue(struct tcp_t *self)
 {
-  debug(TAG, "context %p disconnect", (void *)self);
+  int ret, err;
+  socklen_t len;
+  struct pollfd pfd;
 
-#ifdef WITH_GNUTLS
-  if (self->properties[TCP_PROP_USE_TLS] && atoi(self->properties[TCP_PROP_USE_TLS]) == 1)
+  switch (self->state)
   {
-    gnutls_bye(self->session, GNUTLS_SHUT_RDWR);
-    gnutls_certificate_free_credentials(self->creds);
+#ifdef HAVE_GETADDRINFO_A
+  case TCP_STATE_RESOLVING:
+    ret = gai_error(&self->gai);
+    if (ret == EAI_INPROGRESS)
+      break;
+
+    if (ret != 0)
+    {
+      error(TAG, "failed to lookup hostname %s with reason; %s",
+	    self->properties[TCP_PROP_ADDRESS], gai_strerror(ret));
+      _tcp_close(self, 0);
+      break;
+    }
+
+    self->server = self->gai.ar_result;
+    self->gai.ar_result = NULL;
+    self->addr = self->server;
+    _tcp_connect_addr(self);
+    break;
+#endif
+
+  case TCP_STATE_CONNECTING:
+    pfd.fd = self->socket;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0)
+      break;
+
+    err = 0;
+    len = sizeof(err);
+    if (getsockopt(self->socket, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+      err = errno;
+
+    if (err == 0)
+    {
+      _tcp_connected(self);
+      break;
+    }
+
+    /* try next address */
+    warning(TAG, "failed to connect to host '%s' with reason; %s",
+	    self->properties[TCP_PROP_ADDRESS], strerror(err));
+    close(self->socket);
+    self->socket = -1;
+    self->addr = self->addr->ai_next;
+    _tcp_connect_addr(self);
+    break;
+
+#ifdef WITH_GNUTLS
+  case TCP_STATE_TLS_HANDSHAKE:
+    _tcp_tls_handshake(self);
+    break;
+#endif
+
+  default:
+    break;
   }
+
+  return self->state;
+}
+
+void tcp_wait_resolve(struct tcp_t *self, int timeout)
+{
+#ifdef HAVE_GETADDRINFO_A
+  struct timespec ts;
+
+  if (self->state != TCP_STATE_RESOLVING)
+    return;
+
+  ts.tv_sec = timeout / 1000;
+  ts.tv_nsec = (timeout % 1000) * 1000000L;
+  gai_suspend((const struct gaicb * const *)self->gai_list, 1, (timeout < 0) ? NULL : &ts);
 #endif
-  shutdown(self->socket, SHUT_RDWR);
-  self->socket = -1;
+}
+
+void tcp_connect(struct tcp_t *self)
+{
+  struct pollfd pfd;
+
+  tcp_connect_start(self);
+
+  while (self->state != TCP_STATE_CONNECTED && self->state != TCP_STATE_DISCONNECTED)
+  {
+    if (self->state == TCP_STATE_RESOLVING)
+      tcp_wait_resolve(self, -1);
+    else
+    {
+      pfd.fd = self->socket;
+      pfd.events = tcp_wants_write(self) ? POLLOUT : POLLIN;
+      pfd.revents = 0;
+      poll(&pfd, 1, -1);
+    }
+
+    tcp_connect_continue(self);
+  }
+}
+
+void tcp_disconnect(struct tcp_t *self)
+{
+  debug(TAG, "context %p disconnect", (void *)self);
+  _tcp_close(self, 1);
 }
 
 int tcp_is_connected(struct tcp_t *self)
 {
-  return (self->socket > 0);
+  return (self->state == TCP_STATE_CONNECTED);
+}
+
+tcp_state_t tcp_get_state(struct tcp_t *self)
+{
+  return self->state;
+}
+
+int tcp_wants_write(struct tcp_t *self)
+{
+  switch (self->state)
+  {
+  case TCP_STATE_CONNECTING:
+    return 1;
+
+#ifdef WITH_GNUTLS
+  case TCP_STATE_TLS_HANDSHAKE:
+    return gnutls_record_get_direction(self->session);
+
+  case TCP_STATE_CONNECTED:
+    return self->tls_flush_pending;
+#endif
+
+  default:
+    return 0;
+  }
 }
 
 int tcp_can_read(struct tcp_t *self)
@@ -280,6 +1321,18 @@ int tcp_can_read(struct tcp_t *self)
   fd_set s;
   struct timeval tv;
 
+#ifdef WITH_GNUTLS
+  /* data already decrypted and buffered by gnutls won't show up on socket,
+     the session exists only between handshake start and close */
+  if (self->tls_active && gnutls_record_check_pending(self->session) > 0)
+    return 1;
+#endif
+
+#ifdef WITH_IO_URING
+  if (self->uring)
+    return self->uring->chunk_count > 0 || io_uring_cq_ready(&self->uring->ring) > 0;
+#endif
+
   tv.tv_sec = 0;
   tv.tv_usec = 0;
 
@@ -294,35 +1347,165 @@ int tcp_can_read(struct tcp_t *self)
 
 int tcp_send(struct tcp_t *self, stream_t *stream)
 {
+  struct iovec iov;
+
+  /* sent as vector to queue behind data of io_uring and pending TLS
+     records */
   stream_seek_set(stream, 0);
   debug(TAG, "Sending %ld bytes to peer.", stream_length(stream));
+  iov.iov_base = stream->p;
+  iov.iov_len = stream_length(stream);
+
+  return tcp_sendv(self, &iov, 1, 0);
+}
+
+int tcp_sendv(struct tcp_t *self, const struct iovec *iov, int iovcnt, int flags)
+{
+  int ret;
+  struct msghdr msg;
+
 #ifdef WITH_GNUTLS
+  int i, total;
   if (self->properties[TCP_PROP_USE_TLS] && atoi(self->properties[TCP_PROP_USE_TLS]) == 1)
   {
-    return gnutls_record_send (self->session, stream->p, stream_length(stream));
+    self->send_flags = (flags & TCP_SEND_NONBLOCK) ? MSG_DONTWAIT : 0;
+
+    /* finish flush of records from a previous send that would have blocked */
+    if (self->tls_flush_pending)
+    {
+      ret = gnutls_record_uncork(self->session, (flags & TCP_SEND_NONBLOCK) ? 0 : GNUTLS_RECORD_WAIT);
+      if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED)
+	return 0;
+      if (ret < 0)
+	return ret;
+      self->tls_flush_pending = 0;
+    }
+
+    /* cork records so the vector is sent as few records as possible */
+    total = 0;
+    gnutls_record_cork(self->session);
+    for (i = 0; i < iovcnt; i++)
+    {
+      ret = gnutls_record_send(self->session, iov[i].iov_base, iov[i].iov_len);
+      if (ret < 0)
+      {
+	gnutls_record_uncork(self->session, GNUTLS_RECORD_WAIT);
+	return ret;
+      }
+      total += ret;
+    }
+
+    /* the corked data is owned by gnutls once accepted, if flushing it
+       would block it is completed at next send */
+    ret = gnutls_record_uncork(self->session, (flags & TCP_SEND_NONBLOCK) ? 0 : GNUTLS_RECORD_WAIT);
+    if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED)
+      self->tls_flush_pending = 1;
+    else if (ret < 0)
+      return ret;
+
+    return total;
   }
 #endif
 
-  return send(self->socket, stream->p, stream_length(stream), 0);
+#ifdef WITH_IO_URING
+  if (self->uring)
+  {
+    ret = _tcp_uring_send(self, iov, iovcnt, flags & TCP_SEND_NONBLOCK);
+    if (ret < 0 && errno == EAGAIN)
+      return 0;
+    return ret;
+  }
+#endif
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+
+  ret = sendmsg(self->socket, &msg, MSG_NOSIGNAL | ((flags & TCP_SEND_NONBLOCK) ? MSG_DONTWAIT : 0));
+  if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return 0;
+
+  debug(TAG, "Sent %d bytes of %d vectors to peer.", ret, iovcnt);
+  return ret;
 }
 
-int tcp_recv(struct tcp_t *self, stream_t *stream, size_t length)
+static int
+_tcp_recv(struct tcp_t *self, stream_t *stream, size_t length, int flags)
 {
   int ret;
   debug(TAG, "Receiving %ld bytes from peer.", length);
 
 #ifdef WITH_GNUTLS
   if (self->properties[TCP_PROP_USE_TLS] && atoi(self->properties[TCP_PROP_USE_TLS]) == 1)
+  {
+    self->recv_flags = flags;
     ret = gnutls_record_recv (self->session, stream->p, length);
+    if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED)
+    {
+      errno = EAGAIN;
+      ret = -1;
+    }
+  }
+  else
+#endif
+#ifdef WITH_IO_URING
+  if (self->uring)
+    ret = _tcp_uring_recv(self, stream->p, length, flags & MSG_DONTWAIT);
   else
 #endif
-    ret = recv(self->socket, stream->p, length, 0);
+    ret = recv(self->socket, stream->p, length, flags);
 
   if (ret > 0)
     stream->p += ret;
 
+  /* peer shutdown the connection */
   if (ret == 0)
-    self->socket = 0;
+    _tcp_close(self, 0);
 
   return ret;
 }
+
+int tcp_recv(struct tcp_t *self, stream_t *stream, size_t length)
+{
+  return _tcp_recv(self, stream, length, 0);
+}
+
+int tcp_recv_nonblock(struct tcp_t *self, stream_t *stream, size_t length)
+{
+  return _tcp_recv(self, stream, length, MSG_DONTWAIT);
+}
+
+int tcp_get_fd(struct tcp_t *self)
+{
+#ifdef WITH_IO_URING
+  /* the ring is readable when there are completions to process */
+  if (self->uring)
+    return self->uring->ring.ring_fd;
+#endif
+
+  return self->socket;
+}
+
+int tcp_send_blocked(struct tcp_t *self)
+{
+#ifdef WITH_IO_URING
+  /* process completions so the ring is only readable on new ones */
+  if (self->uring && self->state == TCP_STATE_CONNECTED)
+  {
+    _tcp_uring_reap(self);
+    return !self->uring->send_error
+      && self->uring->send_tail - self->uring->send_head == TCP_URING_SEND_BUFFER_SIZE;
+  }
+#endif
+
+  return 0;
+}
+
+int tcp_send_pending(struct tcp_t *self)
+{
+#ifdef WITH_GNUTLS
+  return self->tls_flush_pending;
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,475 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/* Runs a client against a minimal router on a local socket, which answers
+   the handshake and session creation and then sends a script of messages
+   the client must dispatch to the right sessions. Payloads are written in
+   pieces so messages are framed across partial reads, statuses are written
+   at once so many messages are framed from one read. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <i2cp/i2cp.h>
+#include <i2cp/codec.h>
+
+#define TAG TEST
+
+#define SESSIONS 5
+#define MAX_EVENTS 64
+#define PAYLOADS 40
+
+/* pieces payload messages are written in */
+#define PIECE_SIZE 1000
+
+/* message types of the protocol */
+#define I2CP_MSG_CREATE_SESSION             1
+#define I2CP_MSG_SESSION_STATUS            20
+#define I2CP_MSG_PAYLOAD_MESSAGE           31
+#define I2CP_MSG_GET_DATE                  32
+#define I2CP_MSG_SET_DATE                  33
+
+/* session ids chosen to collide in the session map, sessions[i] is given
+   the id _session_ids[i] by router */
+static uint16_t _session_ids[SESSIONS];
+static struct i2cp_session_t *_sessions[SESSIONS];
+
+/* session status events sent by router and dispatched by client */
+typedef struct event_t
+{
+  uint16_t session_id;
+  uint8_t status;
+} event_t;
+
+static event_t _sent[MAX_EVENTS];
+static int _sent_count;
+static event_t _received[MAX_EVENTS];
+static int _received_count;
+
+static int _payload_count;
+
+static int _listen_fd;
+
+/* Index in the 64 entries session map of a session id, the client uses a
+   Fibonacci hash */
+static uint32_t
+_session_map_index(uint16_t session_id)
+{
+  return ((uint32_t)session_id * 0x9e3779b1) >> 26;
+}
+
+/* Get the skip'th session id with map index */
+static uint16_t
+_colliding_id(uint32_t index, int skip)
+{
+  uint32_t id;
+
+  for (id = 1; id < 0x10000; id++)
+    if (_session_map_index(id) == index && skip-- == 0)
+      return id;
+
+  fatal(TAG, "%s", "No colliding session id.");
+  return 0;
+}
+
+static void
+_router_write(int fd, const uint8_t *data, size_t length)
+{
+  ssize_t ret;
+
+  while (length)
+  {
+    ret = write(fd, data, length);
+    if (ret <= 0)
+      fatal(TAG, "%s", "Router failed to write.");
+    data += ret;
+    length -= ret;
+  }
+}
+
+static int
+_router_read(int fd, uint8_t *data, size_t length)
+{
+  ssize_t ret;
+
+  while (length)
+  {
+    ret = read(fd, data, length);
+    if (ret <= 0)
+      return -1;
+    data += ret;
+    length -= ret;
+  }
+
+  return 0;
+}
+
+/* Append a message to out */
+static void
+_router_frame(stream_t *out, uint8_t type, stream_t *body)
+{
+  stream_out_uint32(out, stream_length(body));
+  stream_out_uint8(out, type);
+  stream_out_uint8p(out, body->data, stream_length(body));
+  stream_mark_end(out);
+}
+
+/* Frame and send a message, if split is set the message is written in
+   pieces giving the client time to read each, the first piece ends within
+   the message header. */
+static void
+_router_send(int fd, uint8_t type, stream_t *body, int split)
+{
+  size_t offset, length;
+  stream_t msg;
+
+  stream_init(&msg, stream_length(body) + 5);
+  _router_frame(&msg, type, body);
+
+  for (offset = 0; offset < stream_length(&msg); offset += length)
+  {
+    length = stream_length(&msg) - offset;
+    if (split && length > (offset ? PIECE_SIZE : 3))
+      length = offset ? PIECE_SIZE : 3;
+
+    _router_write(fd, msg.data + offset, length);
+    if (split)
+      usleep(1000);
+  }
+
+  stream_destroy(&msg);
+}
+
+static void
+_router_status(stream_t *out, uint16_t session_id, uint8_t status)
+{
+  stream_t body;
+
+  stream_init(&body, 3);
+  stream_out_uint16(&body, session_id);
+  stream_out_uint8(&body, status);
+  stream_mark_end(&body);
+  _router_frame(out, I2CP_MSG_SESSION_STATUS, &body);
+  stream_destroy(&body);
+}
+
+/* Content of payload i, the ports carry i */
+static uint8_t
+_payload_byte(int i, size_t offset)
+{
+  return (uint8_t)(i + offset * 7);
+}
+
+static size_t
+_payload_size(int i)
+{
+  /* one message close to the maximum message size */
+  return i == PAYLOADS / 2 ? 60000 : (size_t)i * 997 % 4000;
+}
+
+/* Send payloads to session, incompressible payloads are stored */
+static void
+_router_send_payloads(int fd, uint16_t session_id)
+{
+  int i;
+  size_t j;
+  stream_t payload, gzip, body;
+  struct i2cp_codec_t *codec;
+
+  codec = i2cp_codec_new();
+  stream_init(&payload, 0xffff);
+  stream_init(&gzip, 0xffff);
+  stream_init(&body, 0xffff);
+
+  for (i = 0; i < PAYLOADS; i++)
+  {
+    stream_reset(&payload);
+    for (j = 0; j < _payload_size(i); j++)
+      stream_out_uint8(&payload, _payload_byte(i, j));
+    stream_mark_end(&payload);
+    stream_seek_set(&payload, 0);
+
+    stream_reset(&gzip);
+    if (i2cp_codec_compress(codec, i % 2 ? I2CP_COMPRESSION_STORED : 6, &payload, &gzip) < 0)
+      fatal(TAG, "%s", "Router failed to compress payload.");
+
+    /* ports and protocol in gzip header */
+    stream_seek_set(&gzip, 4);
+    stream_out_uint16(&gzip, i);
+    stream_out_uint16(&gzip, (i ^ 0xffff));
+    stream_skip(&gzip, 1);
+    stream_out_uint8(&gzip, PROTOCOL_DATAGRAM);
+
+    stream_reset(&body);
+    stream_out_uint16(&body, session_id);
+    stream_out_uint32(&body, i);
+    stream_out_uint32(&body, stream_length(&gzip));
+    stream_out_uint8p(&body, gzip.data, stream_length(&gzip));
+    stream_mark_end(&body);
+    _router_send(fd, I2CP_MSG_PAYLOAD_MESSAGE, &body, 1);
+  }
+
+  stream_destroy(&payload);
+  stream_destroy(&gzip);
+  stream_destroy(&body);
+  i2cp_codec_destroy(codec);
+}
+
+static void
+_script_add(uint16_t session_id, uint8_t status)
+{
+  _sent[_sent_count].session_id = session_id;
+  _sent[_sent_count].status = status;
+  _sent_count++;
+}
+
+/* Status updates of every live session of mask */
+static void
+_script_add_updates(int mask)
+{
+  int i;
+
+  for (i = 0; i < SESSIONS; i++)
+    if (mask & (1 << i))
+      _script_add(_session_ids[i], I2CP_SESSION_STATUS_UPDATED);
+}
+
+/* Destroy sessions one by one, each removal shifts the following entries
+   of the probe sequence back, across the end of the map */
+static void
+_script_build()
+{
+  int live;
+
+  live = (1 << SESSIONS) - 1;
+  _script_add_updates(live);
+
+  _script_add(_session_ids[0], I2CP_SESSION_STATUS_DESTROYED);
+  live &= ~(1 << 0);
+  _script_add_updates(live);
+
+  _script_add(_session_ids[2], I2CP_SESSION_STATUS_DESTROYED);
+  live &= ~(1 << 2);
+  _script_add_updates(live);
+
+  _script_add(_session_ids[1], I2CP_SESSION_STATUS_DESTROYED);
+  live &= ~(1 << 1);
+  _script_add_updates(live);
+
+  _script_add(_session_ids[4], I2CP_SESSION_STATUS_DESTROYED);
+  _script_add(_session_ids[3], I2CP_SESSION_STATUS_DESTROYED);
+}
+
+static void *
+_router_thread(void *opaque)
+{
+  int i, fd, one, ret, created;
+  uint8_t type;
+  uint32_t length;
+  uint8_t header[5], *body;
+  stream_t msg;
+  struct timeval tv;
+
+  fd = accept(_listen_fd, NULL, NULL);
+  if (fd < 0)
+    fatal(TAG, "%s", "Router failed to accept.");
+
+  one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  /* protocol byte */
+  if (_router_read(fd, header, 1) < 0 || header[0] != 0x2a)
+    fatal(TAG, "%s", "Router got no protocol byte.");
+
+  created = 0;
+  stream_init(&msg, 0xffff);
+  while (_router_read(fd, header, 5) == 0)
+  {
+    length = (uint32_t)header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+    type = header[4];
+    body = malloc(length ? length : 1);
+    ret = _router_read(fd, body, length);
+    free(body);
+    if (ret < 0)
+      break;
+
+    stream_reset(&msg);
+    switch (type)
+    {
+    case I2CP_MSG_GET_DATE:
+      gettimeofday(&tv, NULL);
+      stream_out_uint64(&msg, (uint64_t)tv.tv_sec * 1000);
+      stream_out_string(&msg, "0.9.20", 6);
+      stream_mark_end(&msg);
+      _router_send(fd, I2CP_MSG_SET_DATE, &msg, 0);
+      break;
+
+    case I2CP_MSG_CREATE_SESSION:
+      _router_status(&msg, _session_ids[created++], I2CP_SESSION_STATUS_CREATED);
+      _router_write(fd, msg.data, stream_length(&msg));
+      if (created < SESSIONS)
+	break;
+
+      _router_send_payloads(fd, _session_ids[1]);
+
+      /* all status messages in one write */
+      stream_reset(&msg);
+      for (i = 0; i < _sent_count; i++)
+	_router_status(&msg, _sent[i].session_id, _sent[i].status);
+      _router_write(fd, msg.data, stream_length(&msg));
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  stream_destroy(&msg);
+  close(fd);
+
+  return NULL;
+}
+
+static void
+_on_status(struct i2cp_session_t *session, i2cp_session_status_t status, void *opaque)
+{
+  if (status == I2CP_SESSION_STATUS_CREATED)
+    return;
+
+  if (_received_count == MAX_EVENTS)
+    fatal(TAG, "%s", "Too many session status events.");
+
+  _received[_received_count].session_id = i2cp_session_get_id(session);
+  _received[_received_count].status = status;
+  _received_count++;
+}
+
+/* Payloads arrive in order with the content sent */
+static void
+_on_message(struct i2cp_session_t *session, i2cp_protocol_t protocol,
+	    uint16_t src_port, uint16_t dest_port, stream_t *payload, void *opaque)
+{
+  size_t j;
+  int i;
+
+  i = _payload_count;
+  if (session != _sessions[1] || protocol != PROTOCOL_DATAGRAM
+      || src_port != i || dest_port != (i ^ 0xffff))
+    fatal(TAG, "Payload %d dispatched with session %p, protocol %d and ports %d, %d.",
+	  i, (void *)session, protocol, src_port, dest_port);
+
+  if (stream_length(payload) != _payload_size(i))
+    fatal(TAG, "Payload %d of %zu bytes != %zu.", i, stream_length(payload), _payload_size(i));
+
+  for (j = 0; j < _payload_size(i); j++)
+    if (payload->data[j] != _payload_byte(i, j))
+      fatal(TAG, "Payload %d differs at %zu.", i, j);
+
+  _payload_count++;
+}
+
+static i2cp_session_callbacks_t _session_cb = { NULL, _on_message, _on_status, NULL };
+
+int main(int argc, char **argv)
+{
+  int i;
+  char port[8];
+  socklen_t len;
+  struct sockaddr_in addr;
+  pthread_t thread;
+  struct i2cp_client_t *client;
+
+  i2cp_init();
+
+  /* three ids share the last index of the map and wrap around to its
+     begin, followed by ids homed there */
+  _session_ids[0] = _colliding_id(63, 0);
+  _session_ids[1] = _colliding_id(63, 1);
+  _session_ids[2] = _colliding_id(63, 2);
+  _session_ids[3] = _colliding_id(0, 0);
+  _session_ids[4] = _colliding_id(1, 0);
+  _script_build();
+
+  /* router listens on a free port */
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(_listen_fd, 1) < 0)
+    fatal(TAG, "%s", "Failed to listen.");
+
+  len = sizeof(addr);
+  getsockname(_listen_fd, (struct sockaddr *)&addr, &len);
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+  pthread_create(&thread, NULL, _router_thread, NULL);
+
+  client = i2cp_client_new(NULL);
+  i2cp_client_set_property(client, CLIENT_PROP_ROUTER_ADDRESS, "127.0.0.1");
+  i2cp_client_set_property(client, CLIENT_PROP_ROUTER_PORT, port);
+  i2cp_client_set_property(client, CLIENT_PROP_ROUTER_USE_TLS, "0");
+  i2cp_client_connect(client);
+  if (!i2cp_client_is_connected(client))
+    fatal(TAG, "%s", "Client failed to connect.");
+
+  for (i = 0; i < SESSIONS; i++)
+  {
+    _sessions[i] = i2cp_session_new(client, &_session_cb, NULL);
+    i2cp_client_create_session(client, _sessions[i]);
+    if (i2cp_session_get_id(_sessions[i]) != _session_ids[i])
+      fatal(TAG, "Session %d got id %d.", i, i2cp_session_get_id(_sessions[i]));
+  }
+
+  /* every payload and every status of the script is dispatched to the
+     session of its id */
+  for (i = 0; i < 1000 && _received_count < _sent_count; i++)
+    i2cp_client_run(client, 10);
+
+  if (_payload_count != PAYLOADS)
+    fatal(TAG, "Received %d of %d payloads.", _payload_count, PAYLOADS);
+
+  if (_received_count != _sent_count)
+    fatal(TAG, "Received %d of %d session status.", _received_count, _sent_count);
+
+  for (i = 0; i < _sent_count; i++)
+  {
+    if (_received[i].session_id != _sent[i].session_id
+	|| _received[i].status != _sent[i].status)
+      fatal(TAG, "Status %d of session %d dispatched to session %d.", _sent[i].status,
+	    _sent[i].session_id, _received[i].session_id);
+  }
+
+  i2cp_client_disconnect(client);
+  pthread_join(thread, NULL);
+  close(_listen_fd);
+
+  for (i = 0; i < SESSIONS; i++)
+    i2cp_session_destroy(_sessions[i]);
+  i2cp_client_destroy(client);
+
+  i2cp_deinit();
+
+  return 0;
+}
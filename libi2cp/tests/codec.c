@@ -0,0 +1,125 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <i2cp/stream.h>
+#include <i2cp/codec.h>
+#include <i2cp/logger.h>
+#include <i2cp/session_config.h>
+
+#define TAG TEST
+
+/* size of the message buffer payloads are compressed into */
+#define MESSAGE_SIZE 0xffff
+
+/* Compress and decompress payload of length, half text and half random, and
+   verify the result including the gzip trailer */
+static void
+_codec_round_trip(struct i2cp_codec_t *codec, int level, size_t length)
+{
+  size_t i;
+  stream_t in, out, res;
+
+  stream_init(&in, length ? length : 1);
+  stream_init(&out, MESSAGE_SIZE);
+  stream_init(&res, MESSAGE_SIZE);
+
+  for (i = 0; i < length; i++)
+    stream_out_uint8(&in, i < length / 2 ? "i2cp payload "[i % 13] : (uint8_t)rand());
+  stream_mark_end(&in);
+  stream_seek_set(&in, 0);
+
+  if (i2cp_codec_compress(codec, level, &in, &out) < 0)
+    fatal(TAG, "Failed to compress %zu bytes at level %d.", length, level);
+
+  /* gzip header as patched by client */
+  if (out.data[0] != 0x1f || out.data[1] != 0x8b || out.data[2] != 8)
+    fatal(TAG, "Invalid gzip header at level %d.", level);
+
+  stream_seek_set(&out, 0);
+  if (i2cp_codec_decompress(codec, &out, &res) < 0)
+    fatal(TAG, "Failed to decompress %zu bytes at level %d.", length, level);
+
+  if (stream_length(&res) != length || memcmp(res.data, in.data, length) != 0)
+    fatal(TAG, "Round trip of %zu bytes at level %d differs.", length, level);
+
+  /* corrupted payload fails the crc check */
+  if (length && level == I2CP_COMPRESSION_STORED)
+  {
+    out.data[out.end - out.data - 9] ^= 0xff;
+    stream_seek_set(&out, 0);
+    stream_reset(&res);
+    if (i2cp_codec_decompress(codec, &out, &res) == 0)
+      fatal(TAG, "%s", "Corrupted stored stream was decompressed.");
+  }
+
+  stream_destroy(&in);
+  stream_destroy(&out);
+  stream_destroy(&res);
+}
+
+/* Payload not fitting the message buffer fails instead of overflowing it */
+static void
+_codec_overflow(struct i2cp_codec_t *codec, int level)
+{
+  size_t i;
+  stream_t in, out;
+
+  stream_init(&in, MESSAGE_SIZE);
+  stream_init(&out, MESSAGE_SIZE);
+
+  for (i = 0; i < MESSAGE_SIZE; i++)
+    stream_out_uint8(&in, (uint8_t)rand());
+  stream_mark_end(&in);
+  stream_seek_set(&in, 0);
+
+  if (i2cp_codec_compress(codec, level, &in, &out) == 0)
+    fatal(TAG, "Random %d bytes at level %d fit the message buffer.", MESSAGE_SIZE, level);
+
+  stream_destroy(&in);
+  stream_destroy(&out);
+}
+
+int main(int argc, char **argv)
+{
+  int level;
+  struct i2cp_codec_t *codec;
+
+  codec = i2cp_codec_new();
+
+  _codec_round_trip(codec, I2CP_COMPRESSION_STORED, 0);
+  _codec_round_trip(codec, I2CP_COMPRESSION_STORED, 1000);
+  _codec_round_trip(codec, I2CP_COMPRESSION_STORED, MESSAGE_SIZE - 100);
+  _codec_overflow(codec, I2CP_COMPRESSION_STORED);
+
+  for (level = 0; level <= 9; level++)
+  {
+    _codec_round_trip(codec, level, 0);
+    _codec_round_trip(codec, level, 1000);
+    _codec_round_trip(codec, level, 30000);
+    _codec_overflow(codec, level);
+  }
+
+  i2cp_codec_destroy(codec);
+
+  return 0;
+}
@@ -40,7 +40,7 @@ i2cp_session_callbacks_t _session_cb = { NULL, on_message, on_status };
 /*
  * Client callback handlers
  */
-void on_disconnect(struct i2cp_client_t *client, char *reason, void *opaque)
+void on_disconnect(struct i2cp_client_t *client, const char *reason, void *opaque)
 {
   fprintf(stderr, "Client %p disconnected with reason; %s\n", (void *)client, reason);
 }
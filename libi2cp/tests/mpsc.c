@@ -0,0 +1,134 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <i2cp/mpsc.h>
+#include <i2cp/logger.h>
+
+#define COUNT 1000
+#define PRODUCERS 4
+#define TAG TEST
+
+typedef struct item_t
+{
+  mpsc_node_t node;
+  int producer;
+  int value;
+} item_t;
+
+static mpsc_queue_t _queue;
+static item_t _items[PRODUCERS][COUNT];
+
+static void *
+_producer(void *opaque)
+{
+  int i, p;
+
+  p = (int)(long)opaque;
+  for (i = 0; i < COUNT; i++)
+    mpsc_push(&_queue, &_items[p][i].node);
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int i, p, popped, next[PRODUCERS];
+  item_t *item;
+  pthread_t threads[PRODUCERS];
+
+  mpsc_init(&_queue);
+
+  /* empty queue */
+  if (!mpsc_is_empty(&_queue) || mpsc_pop(&_queue) != NULL)
+    fatal(TAG, "%s", "New queue is not empty.");
+
+  /* items are popped in order of push */
+  for (i = 0; i < COUNT; i++)
+  {
+    _items[0][i].value = i;
+    mpsc_push(&_queue, &_items[0][i].node);
+  }
+
+  if (mpsc_is_empty(&_queue))
+    fatal(TAG, "%s", "Queue with items is empty.");
+
+  for (i = 0; i < COUNT; i++)
+  {
+    item = (item_t *)mpsc_pop(&_queue);
+    if (item == NULL || item->value != i)
+      fatal(TAG, "Failed to verify item %d in queue.", i);
+  }
+
+  if (!mpsc_is_empty(&_queue) || mpsc_pop(&_queue) != NULL)
+    fatal(TAG, "%s", "Drained queue is not empty.");
+
+  /* interleaved push and pop, down to empty after every pop */
+  for (i = 0; i < COUNT; i++)
+  {
+    mpsc_push(&_queue, &_items[0][i].node);
+    if (i % 2 == 0)
+      continue;
+
+    if ((item_t *)mpsc_pop(&_queue) != &_items[0][i - 1]
+	|| (item_t *)mpsc_pop(&_queue) != &_items[0][i]
+	|| mpsc_pop(&_queue) != NULL)
+      fatal(TAG, "Failed to verify interleaved item %d.", i);
+  }
+
+  /* items of each producer thread are popped in their order */
+  for (p = 0; p < PRODUCERS; p++)
+  {
+    next[p] = 0;
+    for (i = 0; i < COUNT; i++)
+    {
+      _items[p][i].producer = p;
+      _items[p][i].value = i;
+    }
+    pthread_create(&threads[p], NULL, _producer, (void *)(long)p);
+  }
+
+  /* a pop may fail while a push is in progress, retry until all popped */
+  popped = 0;
+  while (popped < PRODUCERS * COUNT)
+  {
+    item = (item_t *)mpsc_pop(&_queue);
+    if (item == NULL)
+    {
+      sched_yield();
+      continue;
+    }
+
+    if (item->value != next[item->producer]++)
+      fatal(TAG, "Item %d of producer %d out of order.", item->value, item->producer);
+    popped++;
+  }
+
+  for (p = 0; p < PRODUCERS; p++)
+    pthread_join(threads[p], NULL);
+
+  if (!mpsc_is_empty(&_queue))
+    fatal(TAG, "%s", "Queue is not empty after popping all items.");
+
+  return 0;
+}
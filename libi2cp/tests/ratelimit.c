@@ -0,0 +1,96 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <i2cp/ratelimit.h>
+#include <i2cp/logger.h>
+
+#define TAG TEST
+
+static uint64_t
+_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv)
+{
+  int delay;
+  int64_t avail;
+  uint64_t start, elapsed;
+  struct ratelimit_t *rl;
+
+  rl = ratelimit_new();
+
+  /* no rate is unlimited */
+  ratelimit_consume(rl, 1000000);
+  if (ratelimit_available(rl) != INT64_MAX || ratelimit_delay(rl) != 0)
+    fatal(TAG, "%s", "Unlimited bucket is limited.");
+
+  /* a new limit starts with a full bucket of burst */
+  ratelimit_set_rate(rl, 1000, 5000);
+  if (ratelimit_get_rate(rl) != 1000 || ratelimit_available(rl) != 5000)
+    fatal(TAG, "%s", "New limit doesn't start with burst.");
+
+  /* a send larger than the bucket puts it into debt, which delays by
+     the time to repay it */
+  ratelimit_consume(rl, 6000);
+  avail = ratelimit_available(rl);
+  if (avail > 0 || avail < -1000)
+    fatal(TAG, "Bucket in debt has %ld bytes available.", (long)avail);
+
+  delay = ratelimit_delay(rl);
+  if (delay < 1 || delay > 1001)
+    fatal(TAG, "Delay of bucket in debt is %d ms.", delay);
+
+  /* burst below rate is raised to rate, refill repays debt and stops
+     at burst */
+  ratelimit_set_rate(rl, 100000, 10000);
+  usleep(1100000);
+  if (ratelimit_available(rl) != 100000)
+    fatal(TAG, "%s", "Bucket doesn't refill to burst of rate.");
+
+  /* bucket refills at rate */
+  start = _now();
+  ratelimit_consume(rl, ratelimit_available(rl));
+  usleep(50000);
+  avail = ratelimit_available(rl);
+  elapsed = _now() - start;
+  if (avail < 4999 || avail > (int64_t)(elapsed * 100000 / 1000000) + 10)
+    fatal(TAG, "Refill of %ld bytes in %ld us.", (long)avail, (long)elapsed);
+
+  if (ratelimit_delay(rl) != 0)
+    fatal(TAG, "%s", "Bucket with tokens has a delay.");
+
+  /* lowering burst caps available tokens */
+  ratelimit_set_rate(rl, 1000, 2000);
+  if (ratelimit_available(rl) != 2000)
+    fatal(TAG, "%s", "Lowered burst doesn't cap tokens.");
+
+  ratelimit_destroy(rl);
+
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+  Part of i2cp C library
+  Copyright (C) 2013 Oliver Queen <oliver@mail.i2p>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <i2cp/spsc.h>
+#include <i2cp/logger.h>
+
+#define COUNT 100000
+#define TAG TEST
+
+static void *
+_producer(void *opaque)
+{
+  long i;
+  struct spsc_t *ring;
+
+  ring = (struct spsc_t *)opaque;
+  for (i = 1; i <= COUNT; i++)
+    while (spsc_push(ring, (void *)i) < 0)
+      sched_yield();
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  long i, value;
+  pthread_t thread;
+  struct spsc_t *ring;
+
+  /* size is rounded up to a power of two */
+  ring = spsc_new(100);
+
+  /* empty ring */
+  if (!spsc_is_empty(ring) || spsc_is_full(ring) || spsc_count(ring) != 0
+      || spsc_pop(ring) != NULL)
+    fatal(TAG, "%s", "New ring is not empty.");
+
+  /* fill ring to full */
+  for (i = 1; i <= 128; i++)
+  {
+    if (spsc_push(ring, (void *)i) < 0)
+      fatal(TAG, "Push of item %ld failed.", i);
+    if (spsc_count(ring) != i)
+      fatal(TAG, "Count %u != %ld.", spsc_count(ring), i);
+  }
+
+  if (!spsc_is_full(ring) || spsc_is_empty(ring) || spsc_push(ring, (void *)i) == 0)
+    fatal(TAG, "%s", "Ring of 128 items is not full.");
+
+  /* items are popped in order of push */
+  for (i = 1; i <= 128; i++)
+  {
+    if ((long)spsc_pop(ring) != i)
+      fatal(TAG, "Failed to verify item %ld in ring.", i);
+  }
+
+  if (!spsc_is_empty(ring) || spsc_pop(ring) != NULL)
+    fatal(TAG, "%s", "Drained ring is not empty.");
+
+  /* wrap around the end of the ring several times */
+  for (i = 1; i <= 1000; i++)
+  {
+    spsc_push(ring, (void *)i);
+    spsc_push(ring, (void *)-i);
+    if ((long)spsc_pop(ring) != i || (long)spsc_pop(ring) != -i)
+      fatal(TAG, "Failed to verify wrapped item %ld.", i);
+  }
+
+  /* a producer thread fills the ring faster than it is drained */
+  pthread_create(&thread, NULL, _producer, ring);
+  for (i = 1; i <= COUNT; i++)
+  {
+    while ((value = (long)spsc_pop(ring)) == 0)
+      sched_yield();
+    if (value != i)
+      fatal(TAG, "Item %ld != %ld.", value, i);
+  }
+  pthread_join(thread, NULL);
+
+  if (!spsc_is_empty(ring))
+    fatal(TAG, "%s", "Ring is not empty after popping all items.");
+
+  spsc_destroy(ring);
+
+  return 0;
+}
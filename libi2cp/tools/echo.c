@@ -228,8 +228,8 @@ int main(int argc, char **argv)
   /* main loop */
   while (echo.got_response == 0)
   {
-    i2cp_client_process_io(echo.client);
-    usleep(100);
+    if (i2cp_client_run(echo.client, 1000) < 0)
+      break;
   }
 
   /* close and exit */
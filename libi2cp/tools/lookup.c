@@ -115,8 +115,8 @@ int main(int argc, char **argv)
 
   while (lookup.got_response == 0)
   {
-    i2cp_client_process_io(lookup.client);
-    usleep(100);
+    if (i2cp_client_run(lookup.client, 1000) < 0)
+      break;
   }
 
   i2cp_session_destroy(lookup.session);